@@ -1,5 +1,14 @@
 #include <iostream>
 #include <ctime>
+#include <immintrin.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 int myStrlen(const char* str) {
     int len = 0;
@@ -30,135 +39,505 @@ void myStrcpy(char* dest, const char* src) {
     *dest = '\0';
 }
 
+const double LN2 = 0.6931471805599453;
+const double SQRT2 = 1.4142135623730951;
+const int LOG_SERIES_TERMS = 12;
+
 double myLog(double x) {
     if (x <= 0) return 0;
     
-    double result = 0;
-    double term = (x - 1) / (x + 1);
+    union { double value; unsigned long long bits; } split;
+    split.value = x;
+    int exponent = (int)(split.bits >> 52) - 1023;
+    split.bits = (split.bits & 0xFFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+    double mantissa = split.value;
+    if (mantissa > SQRT2) {
+        mantissa *= 0.5;
+        exponent++;
+    }
+    
+    double term = (mantissa - 1) / (mantissa + 1);
     double term_sq = term * term;
-    double current = term;
+    double series = 1.0 / (2 * LOG_SERIES_TERMS - 1);
+    for (int i = LOG_SERIES_TERMS - 2; i >= 0; i--) {
+        series = series * term_sq + 1.0 / (2 * i + 1);
+    }
     
-    for (int i = 0; i < 20; i++) {
-        result += current / (2 * i + 1);
-        current *= term_sq;
+    return exponent * LN2 + 2 * term * series;
+}
+
+double myExp(double x) {
+    if (x < -700) return 0;
+    if (x > 700) x = 700;
+    
+    int k = (int)(x / LN2 + (x < 0 ? -0.5 : 0.5));
+    double r = x - k * LN2;
+    double result = 1;
+    double term = 1;
+    for (int i = 1; i < 20; i++) {
+        term *= r / i;
+        result += term;
     }
     
-    return 2 * result;
+    union { double value; unsigned long long bits; } scale;
+    scale.bits = (unsigned long long)(k + 1023) << 52;
+    return result * scale.value;
 }
 
 double fabs(double x) {
     return (x < 0) ? -x : x;
-}const int HASH_TABLE_SIZE = 50021;
+}
 
-unsigned int hashFunction(const char* str) {
-    unsigned int hash = 5381;
-    int c;
+/*
+Открытая адресация с вытеснением Robin Hood: таблица хранит кэшированный
+хеш, длину ключа и индекс записи во внешнем плотном массиве. Ключи короче
+INLINE_KEY_SIZE байт лежат прямо в слоте, длинные - указателем на строку
+владельца. При заполнении на 80% таблица удваивается без пересчёта хешей.
+*/
+
+const int INLINE_KEY_SIZE = 20;
+
+unsigned int hashBytes(const char* str, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+class OpenHashTable {
+private:
+    struct Slot {
+        unsigned int hash;
+        int index;
+        unsigned short length;
+        unsigned short distance;
+        union {
+            char inline_key[INLINE_KEY_SIZE];
+            const char* key;
+        };
+    };
+    
+    Slot* slots;
+    unsigned int capacity;
+    unsigned int mask;
+    int count;
     
-    while ((c = *str++)) {
-        if (c >= 'A' && c <= 'Z') c = c + 32;
-        hash = ((hash << 5) + hash) + c;
+    static const char* keyOf(const Slot& slot) {
+        return slot.length < INLINE_KEY_SIZE ? slot.inline_key : slot.key;
     }
     
-    return hash % HASH_TABLE_SIZE;
-}
+    static bool sameKey(const Slot& slot, const char* key, int len) {
+        const char* stored = keyOf(slot);
+        for (int i = 0; i < len; i++) {
+            if (stored[i] != key[i]) return false;
+        }
+        return true;
+    }
+    
+    void place(Slot candidate) {
+        unsigned int pos = candidate.hash & mask;
+        candidate.distance = 1;
+        
+        while (true) {
+            Slot& slot = slots[pos];
+            if (slot.distance == 0) {
+                slot = candidate;
+                return;
+            }
+            if (slot.distance < candidate.distance) {
+                Slot displaced = slot;
+                slot = candidate;
+                candidate = displaced;
+            }
+            candidate.distance++;
+            pos = (pos + 1) & mask;
+        }
+    }
+    
+    void grow() {
+        Slot* old_slots = slots;
+        unsigned int old_capacity = capacity;
+        
+        capacity *= 2;
+        mask = capacity - 1;
+        slots = new Slot[capacity];
+        for (unsigned int i = 0; i < capacity; i++) {
+            slots[i].distance = 0;
+        }
+        
+        for (unsigned int i = 0; i < old_capacity; i++) {
+            if (old_slots[i].distance != 0) {
+                place(old_slots[i]);
+            }
+        }
+        delete[] old_slots;
+    }
+    
+public:
+    OpenHashTable(unsigned int initial_capacity = 1024) : capacity(initial_capacity), count(0) {
+        mask = capacity - 1;
+        slots = new Slot[capacity];
+        for (unsigned int i = 0; i < capacity; i++) {
+            slots[i].distance = 0;
+        }
+    }
+    
+    ~OpenHashTable() {
+        delete[] slots;
+    }
+    
+    int find(const char* key, int len, unsigned int hash) const {
+        unsigned int pos = hash & mask;
+        unsigned short distance = 1;
+        
+        while (true) {
+            const Slot& slot = slots[pos];
+            if (slot.distance < distance) return -1;
+            if (slot.hash == hash && slot.length == len && sameKey(slot, key, len)) {
+                return slot.index;
+            }
+            distance++;
+            pos = (pos + 1) & mask;
+        }
+    }
+    
+    void insert(const char* stable_key, int len, unsigned int hash, int index) {
+        if ((unsigned int)(count + 1) * 5 > capacity * 4) {
+            grow();
+        }
+        
+        Slot candidate;
+        candidate.hash = hash;
+        candidate.index = index;
+        candidate.length = (unsigned short)len;
+        if (len < INLINE_KEY_SIZE) {
+            for (int i = 0; i < len; i++) {
+                candidate.inline_key[i] = stable_key[i];
+            }
+        } else {
+            candidate.key = stable_key;
+        }
+        
+        place(candidate);
+        count++;
+    }
+    
+    int getCount() const { return count; }
+    unsigned int getCapacity() const { return capacity; }
+};
+
+class Arena {
+private:
+    struct Block {
+        Block* next;
+        long long size;
+        long long used;
+    };
+    
+    static const long long BLOCK_SIZE = 1 << 20;
+    
+    Block* head;
+    long long bytes_reserved;
+    long long bytes_used;
+    
+    Block* newBlock(long long size) {
+        char* memory = new char[sizeof(Block) + size];
+        Block* block = (Block*)memory;
+        block->next = head;
+        block->size = size;
+        block->used = 0;
+        head = block;
+        bytes_reserved += size;
+        return block;
+    }
+    
+public:
+    Arena() : head(nullptr), bytes_reserved(0), bytes_used(0) {}
+    
+    ~Arena() {
+        release();
+    }
+    
+    void* allocate(long long bytes) {
+        bytes = (bytes + 7) & ~7LL;
+        
+        if (!head || head->used + bytes > head->size) {
+            newBlock(bytes > BLOCK_SIZE ? bytes : BLOCK_SIZE);
+        }
+        
+        char* result = (char*)(head + 1) + head->used;
+        head->used += bytes;
+        bytes_used += bytes;
+        return result;
+    }
+    
+    char* copyString(const char* str, int len) {
+        char* result = (char*)allocate(len + 1);
+        for (int i = 0; i < len; i++) {
+            result[i] = str[i];
+        }
+        result[len] = '\0';
+        return result;
+    }
+    
+    void release() {
+        while (head) {
+            Block* next = head->next;
+            delete[] (char*)head;
+            head = next;
+        }
+        bytes_reserved = 0;
+        bytes_used = 0;
+    }
+    
+    long long getBytesUsed() const { return bytes_used; }
+    long long getBytesReserved() const { return bytes_reserved; }
+};
 
 struct TokenFreq {
     char* text;
     int length;
     int frequency;
-    TokenFreq* next;
+    int id;
 };
 
 struct FreqPair {
-    char* text;
+    const char* text;
     int freq;
 };
 
 class HashMap {
 private:
-    TokenFreq** table;
+    OpenHashTable table;
+    Arena strings;
+    TokenFreq* entries;
+    int entries_capacity;
     int unique_count;
-    int total_count;
+    long long total_count;
     
 public:
     HashMap() {
-        table = new TokenFreq*[HASH_TABLE_SIZE];
-        for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-            table[i] = nullptr;
-        }
+        entries_capacity = 1024;
+        entries = new TokenFreq[entries_capacity];
         unique_count = 0;
         total_count = 0;
     }
     
     ~HashMap() {
-        for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-            TokenFreq* current = table[i];
-            while (current) {
-                TokenFreq* next = current->next;
-                delete[] current->text;
-                delete current;
-                current = next;
-            }
-        }
-        delete[] table;
+        delete[] entries;
     }
     
-    void addToken(const char* token_text, int token_len) {
-        unsigned int index = hashFunction(token_text);
+    int addToken(const char* token_text, int token_len) {
+        unsigned int hash = hashBytes(token_text, token_len);
         
-        TokenFreq* current = table[index];
-        while (current) {
-            if (myStrcmp(current->text, token_text)) {
-                current->frequency++;
-                total_count++;
-                return;
+        int id = table.find(token_text, token_len, hash);
+        if (id >= 0) {
+            entries[id].frequency++;
+            total_count++;
+            return id;
+        }
+        
+        if (unique_count >= entries_capacity) {
+            entries_capacity *= 2;
+            TokenFreq* new_entries = new TokenFreq[entries_capacity];
+            for (int i = 0; i < unique_count; i++) {
+                new_entries[i] = entries[i];
             }
-            current = current->next;
+            delete[] entries;
+            entries = new_entries;
         }
         
-        TokenFreq* new_token = new TokenFreq;
-        new_token->text = new char[token_len + 1];
-        myStrcpy(new_token->text, token_text);
-        new_token->length = token_len;
-        new_token->frequency = 1;
+        TokenFreq& new_token = entries[unique_count];
+        new_token.text = strings.copyString(token_text, token_len);
+        new_token.length = token_len;
+        new_token.frequency = 1;
+        new_token.id = unique_count;
         
-        new_token->next = table[index];
-        table[index] = new_token;
+        table.insert(new_token.text, token_len, hash, new_token.id);
         
         unique_count++;
         total_count++;
+        return new_token.id;
+    }
+    
+    const TokenFreq* getById(int id) const {
+        return &entries[id];
     }
     
     int getUniqueCount() const {
         return unique_count;
     }
     
-    int getTotalCount() const {
+    long long getStringBytes() const {
+        return strings.getBytesUsed();
+    }
+    
+    long long getTotalCount() const {
         return total_count;
     }
     
     FreqPair* toArray() {
         FreqPair* array = new FreqPair[unique_count];
-        int index = 0;
-        
-        for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-            TokenFreq* current = table[i];
-            while (current) {
-                array[index].text = new char[current->length + 1];
-                myStrcpy(array[index].text, current->text);
-                array[index].freq = current->frequency;
-                
-                current = current->next;
-                index++;
-            }
+        
+        for (int i = 0; i < unique_count; i++) {
+            array[i].text = entries[i].text;
+            array[i].freq = entries[i].frequency;
         }
         
         return array;
     }
-};class RussianStemmer {
+};
+
+/*
+Суффиксный автомат стеммера: суффиксы записываются в обратном порядке в
+префиксное дерево, которое строится на этапе компиляции (constexpr).
+Байты, не встречающиеся ни в одном суффиксе, отображаются в класс 0 и
+сразу обрывают проход. Проход идёт с конца слова назад и запоминает самый
+длинный суффикс, после отсечения которого остаётся не меньше 3 байт.
+*/
+
+const int SUFFIX_MAX_NODES = 160;
+const int SUFFIX_MAX_CLASSES = 32;
+
+struct SuffixAutomaton {
+    unsigned char byte_class[256];
+    unsigned char transitions[SUFFIX_MAX_NODES][SUFFIX_MAX_CLASSES];
+    bool accepting[SUFFIX_MAX_NODES];
+    int node_count;
+    int class_count;
+    
+    int longestSuffix(const char* word, int len, int min_stem) const {
+        int node = 1;
+        int best = 0;
+        for (int depth = 1; depth <= len - min_stem; depth++) {
+            node = transitions[node][byte_class[(unsigned char)word[len - depth]]];
+            if (node == 0) break;
+            if (accepting[node]) best = depth;
+        }
+        return best;
+    }
+};
+
+template <int N>
+constexpr SuffixAutomaton buildSuffixAutomaton(const char* const (&suffixes)[N]) {
+    SuffixAutomaton automaton = {};
+    automaton.node_count = 2;
+    automaton.class_count = 1;
+    
+    for (int s = 0; s < N; s++) {
+        int len = 0;
+        while (suffixes[s][len] != '\0') len++;
+        
+        int node = 1;
+        for (int i = len - 1; i >= 0; i--) {
+            unsigned char c = (unsigned char)suffixes[s][i];
+            if (automaton.byte_class[c] == 0) {
+                automaton.byte_class[c] = (unsigned char)automaton.class_count++;
+            }
+            unsigned char cls = automaton.byte_class[c];
+            if (automaton.transitions[node][cls] == 0) {
+                automaton.transitions[node][cls] = (unsigned char)automaton.node_count++;
+            }
+            node = automaton.transitions[node][cls];
+        }
+        automaton.accepting[node] = true;
+    }
+    
+    return automaton;
+}
+
+constexpr const char* RUSSIAN_SUFFIXES[] = {
+    "\xD0\xB0\xD0\xBC\xD0\xB8", "\xD1\x8F\xD0\xBC\xD0\xB8",
+    "\xD0\xBE\xD0\xB2", "\xD0\xB5\xD0\xB2",
+    "\xD0\xB0\xD1\x85", "\xD1\x8F\xD1\x85",
+    "\xD0\xBE\xD0\xBC", "\xD0\xB5\xD0\xBC",
+    "\xD0\xBE\xD0\xB9", "\xD0\xB5\xD0\xB9", "\xD1\x8B\xD0\xB9", "\xD0\xB8\xD0\xB9",
+    "\xD0\xB0\xD1\x8F", "\xD1\x8F\xD1\x8F",
+    "\xD0\xBE\xD0\xB5", "\xD0\xB5\xD0\xB5",
+    "\xD1\x8B\xD0\xB5", "\xD0\xB8\xD0\xB5",
+    "\xD1\x82\xD1\x8C",
+    "\xD0\xB5\xD1\x82", "\xD0\xB8\xD1\x82", "\xD1\x8E\xD1\x82", "\xD1\x8F\xD1\x82",
+    "\xD0\xB0\xD0\xBB", "\xD0\xB5\xD0\xBB", "\xD0\xB8\xD0\xBB",
+    "\xD1\x83", "\xD1\x8E", "\xD0\xB0", "\xD1\x8F",
+    "\xD1\x8B", "\xD0\xB8", "\xD0\xBE", "\xD0\xB5",
+    "ing", "ed", "ly", "er", "s"
+};
+
+constexpr SuffixAutomaton RUSSIAN_SUFFIX_AUTOMATON = buildSuffixAutomaton(RUSSIAN_SUFFIXES);
+
+/*
+Кэш стемминга с прямым отображением: слот выбирается по хешу словоформы,
+при коллизии старая запись перезаписывается. Основа всегда является
+префиксом словоформы, поэтому хранится только её длина.
+*/
+
+class StemCache {
+private:
+    static const int SLOT_COUNT = 4096;
+    static const int MAX_KEY_LENGTH = 58;
+    
+    struct Slot {
+        unsigned int hash;
+        unsigned char length;
+        unsigned char stem_length;
+        char key[MAX_KEY_LENGTH];
+    };
+    
+    Slot* slots;
+    long long lookups;
+    long long hits;
+    
+    StemCache(const StemCache&) = delete;
+    StemCache& operator=(const StemCache&) = delete;
+    
+public:
+    StemCache() : lookups(0), hits(0) {
+        slots = new Slot[SLOT_COUNT];
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            slots[i].length = 0;
+        }
+    }
+    
+    ~StemCache() {
+        delete[] slots;
+    }
+    
+    int find(const char* word, int len, unsigned int hash) {
+        lookups++;
+        const Slot& slot = slots[hash & (SLOT_COUNT - 1)];
+        if (slot.hash != hash || slot.length != len) return -1;
+        for (int i = 0; i < len; i++) {
+            if (slot.key[i] != word[i]) return -1;
+        }
+        hits++;
+        return slot.stem_length;
+    }
+    
+    void store(const char* word, int len, unsigned int hash, int stem_len) {
+        if (len > MAX_KEY_LENGTH) return;
+        Slot& slot = slots[hash & (SLOT_COUNT - 1)];
+        slot.hash = hash;
+        slot.length = (unsigned char)len;
+        slot.stem_length = (unsigned char)stem_len;
+        for (int i = 0; i < len; i++) {
+            slot.key[i] = word[i];
+        }
+    }
+    
+    long long getLookups() const { return lookups; }
+    long long getHits() const { return hits; }
+};
+
+class RussianStemmer {
 private:
     char buffer[256];
     int len;
+    StemCache cache;
     
     void copy(const char* str) {
         len = 0;
@@ -169,629 +548,4021 @@ private:
         buffer[len] = '\0';
     }
     
-    bool removeIfEndsWith(const char* ending) {
-        int endLen = 0;
-        while (ending[endLen] != '\0') endLen++;
-        
-        if (len < endLen) return false;
-        
-        bool match = true;
-        for (int i = 0; i < endLen; i++) {
-            if (buffer[len - endLen + i] != ending[i]) {
-                match = false;
-                break;
-            }
-        }
-        
-        if (match && len - endLen >= 3) {
-            len -= endLen;
-            buffer[len] = '\0';
-            return true;
-        }
-        return false;
-    }
-    
 public:
     const char* stem(const char* word) {
         copy(word);
         
         if (len < 4) return buffer;
         
+        unsigned int hash = hashBytes(buffer, len);
+        int stem_len = cache.find(buffer, len, hash);
+        if (stem_len < 0) {
+            stem_len = len - RUSSIAN_SUFFIX_AUTOMATON.longestSuffix(buffer, len, 3);
+            cache.store(buffer, len, hash, stem_len);
+        }
         
-        
-        
-        if (removeIfEndsWith("\xD0\xB0\xD0\xBC\xD0\xB8")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD0\xBC\xD0\xB8")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB2")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB2")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xB0\xD1\x85")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD1\x85")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xBE\xD0\xBC")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xBC")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD1\x8B\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD0\xB9")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xB0\xD1\x8F")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD1\x8f")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB5")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD1\x8B\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD0\xB5")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD1\x82\xD1\x8C")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xB5\xD1\x82")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD1\x82")) return buffer;
-        if (removeIfEndsWith("\xD1\x8E\xD1\x82")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD1\x82")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD0\xB0\xD0\xBB")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xBB")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD0\xBB")) return buffer;
-        
-        
-        if (removeIfEndsWith("\xD1\x83")) return buffer;
-        if (removeIfEndsWith("\xD1\x8E")) return buffer;
-        if (removeIfEndsWith("\xD0\xB0")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F")) return buffer;
-        if (removeIfEndsWith("\xD1\x8B")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5")) return buffer;
-        
-        
-        if (removeIfEndsWith("ing")) return buffer;
-        if (removeIfEndsWith("ed")) return buffer;
-        if (removeIfEndsWith("ly")) return buffer;
-        if (removeIfEndsWith("er")) return buffer;
-        if (removeIfEndsWith("s")) return buffer;
-        
+        len = stem_len;
+        buffer[len] = '\0';
         return buffer;
     }
+    
+    long long getCacheLookups() const { return cache.getLookups(); }
+    long long getCacheHits() const { return cache.getHits(); }
 };
 
-int partition(FreqPair* array, int low, int high) {
-    int pivot = array[high].freq;
-    int i = low - 1;
-    
-    for (int j = low; j < high; j++) {
-        if (array[j].freq > pivot) {
-            i++;
-            FreqPair temp = array[i];
-            array[i] = array[j];
-            array[j] = temp;
-        }
-    }
-    
-    FreqPair temp = array[i + 1];
-    array[i + 1] = array[high];
-    array[high] = temp;
-    
-    return i + 1;
+/*
+Ранжирование частот. Отчётам нужны только первые K токенов: они
+выбираются кучей из K элементов за O(n log K). Полный рейтинг для выгрузки
+сортируется устойчивой поразрядной сортировкой по убыванию частоты
+(проходы по 11 бит): гистограммы и раскладка делятся между потоками по
+непрерывным диапазонам, поэтому при равной частоте сохраняется порядок
+первого появления токена - тот же, что и в выборке K лучших.
+*/
+
+const int REPORT_TOP_K = 50;
+const int RADIX_BITS = 11;
+const int RADIX_BUCKETS = 1 << RADIX_BITS;
+const int PARALLEL_SORT_MIN_SIZE = 1 << 16;
+
+bool rankedBefore(const FreqPair* array, int a, int b) {
+    return array[a].freq > array[b].freq || (array[a].freq == array[b].freq && a < b);
 }
 
-void quickSort(FreqPair* array, int low, int high) {
-    if (low < high) {
-        int pi = partition(array, low, high);
-        quickSort(array, low, pi - 1);
-        quickSort(array, pi + 1, high);
+void siftDown(const FreqPair* array, int* heap, int size, int node) {
+    while (true) {
+        int worst = node;
+        int left = node * 2 + 1;
+        int right = left + 1;
+        if (left < size && rankedBefore(array, heap[worst], heap[left])) worst = left;
+        if (right < size && rankedBefore(array, heap[worst], heap[right])) worst = right;
+        if (worst == node) return;
+        
+        int temp = heap[node];
+        heap[node] = heap[worst];
+        heap[worst] = temp;
+        node = worst;
     }
 }
 
-void sortFreqArray(FreqPair* array, int size) {
-    if (size > 1) {
-        quickSort(array, 0, size - 1);
-    }
-}char* extractContentFromXML(const char* xml_content, int xml_size, int& extracted_size) {
-    char* text = new char[xml_size + 1];
-    int text_pos = 0;
+FreqPair* selectTopK(const FreqPair* array, int size, int k) {
+    if (k > size) k = size;
+    FreqPair* top = new FreqPair[k > 0 ? k : 1];
+    if (k <= 0) return top;
     
-    const char* ptr = xml_content;
-    const char* end = xml_content + xml_size;
-    
-    while (ptr < end) {
-        if (myStrncmp(ptr, "<content>", 9) == 0) {
-            ptr += 9;
-            
-            while (ptr < end && (*ptr == ' ' || *ptr == '\n' || *ptr == '\t' || *ptr == '\r')) {
-                ptr++;
-            }
-            
-            if (myStrncmp(ptr, "&lt;![CDATA[", 11) == 0) {
-                ptr += 11;
-                
-                while (ptr < end && !(myStrncmp(ptr, "]]&gt;", 4) == 0)) {
-                    if (myStrncmp(ptr, "&quot;", 6) == 0) {
-                        text[text_pos++] = '"';
-                        ptr += 6;
-                    } else if (myStrncmp(ptr, "&amp;", 5) == 0) {
-                        text[text_pos++] = '&';
-                        ptr += 5;
-                    } else if (myStrncmp(ptr, "&lt;", 4) == 0) {
-                        text[text_pos++] = '<';
-                        ptr += 4;
-                    } else if (myStrncmp(ptr, "&gt;", 4) == 0) {
-                        text[text_pos++] = '>';
-                        ptr += 4;
-                    } else {
-                        text[text_pos++] = *ptr++;
-                    }
-                }
-                
-                if (ptr < end) {
-                    ptr += 4;
-                }
+    int* heap = new int[k];
+    int heap_size = 0;
+    for (int i = 0; i < size; i++) {
+        if (heap_size < k) {
+            int child = heap_size++;
+            heap[child] = i;
+            while (child > 0) {
+                int parent = (child - 1) / 2;
+                if (!rankedBefore(array, heap[parent], heap[child])) break;
+                int temp = heap[parent];
+                heap[parent] = heap[child];
+                heap[child] = temp;
+                child = parent;
             }
-            
-            text[text_pos++] = ' ';
-        } else {
-            ptr++;
+        } else if (rankedBefore(array, i, heap[0])) {
+            heap[0] = i;
+            siftDown(array, heap, k, 0);
         }
     }
     
-    text[text_pos] = '\0';
-    extracted_size = text_pos;
+    for (int n = k; n > 0; n--) {
+        top[n - 1] = array[heap[0]];
+        heap[0] = heap[n - 1];
+        siftDown(array, heap, n - 1, 0);
+    }
     
-    return text;
+    delete[] heap;
+    return top;
 }
 
-char* readFile(const char* filename, int& size) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        std::cerr << "Не могу открыть файл: " << filename << std::endl;
-        return nullptr;
+template <typename Task>
+void runParallel(int num_threads, Task task) {
+    std::thread* workers = new std::thread[num_threads];
+    for (int t = 1; t < num_threads; t++) {
+        workers[t] = std::thread(task, t);
     }
-    
-    fseek(file, 0, SEEK_END);
-    size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char* buffer = new char[size + 1];
-    fread(buffer, 1, size, file);
-    buffer[size] = '\0';
-    
-    fclose(file);
-    return buffer;
+    task(0);
+    for (int t = 1; t < num_threads; t++) {
+        workers[t].join();
+    }
+    delete[] workers;
 }
 
-void toLowerCase(char* str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        unsigned char c = (unsigned char)str[i];
+void sortFreqArray(FreqPair* array, int size, int num_threads) {
+    if (size < 2) return;
+    if (num_threads < 1 || size < PARALLEL_SORT_MIN_SIZE) num_threads = 1;
+    
+    FreqPair* buffer = new FreqPair[size];
+    int* counts = new int[num_threads * RADIX_BUCKETS];
+    FreqPair* src = array;
+    FreqPair* dst = buffer;
+    
+    for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+        auto digit = [shift](const FreqPair& pair) {
+            return (int)((~(unsigned int)pair.freq >> shift) & (RADIX_BUCKETS - 1));
+        };
         
+        runParallel(num_threads, [&](int t) {
+            int* local = counts + t * RADIX_BUCKETS;
+            for (int b = 0; b < RADIX_BUCKETS; b++) local[b] = 0;
+            int first = (int)((long long)size * t / num_threads);
+            int last = (int)((long long)size * (t + 1) / num_threads);
+            for (int i = first; i < last; i++) local[digit(src[i])]++;
+        });
         
-        if (c >= 'A' && c <= 'Z') {
-            str[i] = c + 32;
+        bool single_bucket = false;
+        int position = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            int bucket_start = position;
+            for (int t = 0; t < num_threads; t++) {
+                int count = counts[t * RADIX_BUCKETS + b];
+                counts[t * RADIX_BUCKETS + b] = position;
+                position += count;
+            }
+            if (position - bucket_start == size) single_bucket = true;
         }
+        if (single_bucket) continue;
         
-        else if (c == 0xD0) {
-            unsigned char next = (unsigned char)str[i + 1];
-            
-            if (next >= 0x90 && next <= 0x9F) {
-                str[i + 1] = next + 0x20;
-                i++;
-            }
-            
-            
-            
-            
-            else if (next >= 0xA0 && next <= 0xAF) {
-                str[i] = 0xD1;  
-                str[i + 1] = next - 0x20;  
-                i++;
-            }
-            
-            else if (next == 0x81) {
-                str[i] = 0xD1;
-                str[i + 1] = 0x91;
-                i++;
-            }
+        runParallel(num_threads, [&](int t) {
+            int* offsets = counts + t * RADIX_BUCKETS;
+            int first = (int)((long long)size * t / num_threads);
+            int last = (int)((long long)size * (t + 1) / num_threads);
+            for (int i = first; i < last; i++) dst[offsets[digit(src[i])]++] = src[i];
+        });
+        
+        FreqPair* temp = src;
+        src = dst;
+        dst = temp;
+    }
+    
+    if (src != array) {
+        for (int i = 0; i < size; i++) {
+            array[i] = src[i];
         }
     }
+    
+    delete[] counts;
+    delete[] buffer;
 }
 
-bool isDelimiter(char c) {
-    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || 
-           c == ',' || c == '.' || c == '!' || c == '?' || 
-           c == ';' || c == ':' || c == '(' || c == ')' ||
-           c == '[' || c == ']' || c == '"' || c == '\'' ||
-           c == '-' || c == '_' || c == '/' || c == '\\';
+/*
+Приближённая статистика частот в ограниченной памяти (режим --approx).
+Count-Min Sketch (4 строки по 65536 счётчиков, консервативное обновление)
+оценивает частоту любого токена сверху. Space-Saving держит 1024
+кандидата в частые токены: новый токен вытесняет кандидата с минимальным
+счётчиком и наследует его значение как погрешность; итоговая частота -
+меньшая из двух оценок. HyperLogLog (2^14 регистров) оценивает число
+уникальных токенов с относительной ошибкой около 0.8%.
+*/
+
+unsigned long long hashBytes64(const char* str, int len) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
 }
 
-bool isJunkToken(const char* token) {
-    const char* junk_tokens[] = {
-        "http", "https", "www", "html", "xml", 
-        "url", "content", "statistics", "character_count",
-        "word_count", "article", "source", "id", "meta",
-        "total_articles", "generated_date", "cdata", 
-        "&lt", "&gt", "&amp", "&quot", "]]&gt", "<![cdata[",
-        "f1news", "ru", "news", "f1", NULL
-    };
+class CountMinSketch {
+private:
+    static const int DEPTH = 4;
+    static const int WIDTH = 1 << 16;
     
-    for (int i = 0; junk_tokens[i] != NULL; i++) {
-        if (myStrcmp(token, junk_tokens[i])) {
-            return true;
+    unsigned int* counters;
+    
+    static int bucket(unsigned long long hash, int row) {
+        unsigned int h1 = (unsigned int)hash;
+        unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+        return row * WIDTH + ((h1 + row * h2) & (WIDTH - 1));
+    }
+    
+public:
+    CountMinSketch() {
+        counters = new unsigned int[DEPTH * WIDTH];
+        for (int i = 0; i < DEPTH * WIDTH; i++) {
+            counters[i] = 0;
         }
     }
     
-    if (token[0] == 'h' && token[1] == 't' && token[2] == 't' && token[3] == 'p')
-        return true;
-    if (token[0] == 'w' && token[1] == 'w' && token[2] == 'w')
-        return true;
+    ~CountMinSketch() {
+        delete[] counters;
+    }
     
-    if (myStrlen(token) == 1) {
-        char c = token[0];
-        if (!((c >= 'а' && c <= 'я') || (c >= 'a' && c <= 'z') || 
-              c == 'ё' || c == 'й' || c == '-')) {
-            return true;
+    void add(unsigned long long hash) {
+        unsigned int updated = estimate(hash) + 1;
+        for (int row = 0; row < DEPTH; row++) {
+            unsigned int& counter = counters[bucket(hash, row)];
+            if (counter < updated) counter = updated;
         }
     }
     
-    return false;
-}
+    unsigned int estimate(unsigned long long hash) const {
+        unsigned int minimum = counters[bucket(hash, 0)];
+        for (int row = 1; row < DEPTH; row++) {
+            unsigned int counter = counters[bucket(hash, row)];
+            if (counter < minimum) minimum = counter;
+        }
+        return minimum;
+    }
+    
+    long long getBytes() const { return (long long)DEPTH * WIDTH * sizeof(unsigned int); }
+};
 
-void tokenizeText(const char* text, HashMap& hashmap) {
-    int i = 0;
-    int len = myStrlen(text);
+class SpaceSaving {
+private:
+    static const int CAPACITY = 1024;
+    static const int INDEX_SIZE = CAPACITY * 4;
+    static const int MAX_KEY_LENGTH = 50;
     
-    while (i < len) {
-        while (i < len && isDelimiter(text[i])) {
-            i++;
-        }
+    struct Counter {
+        unsigned long long hash;
+        long long count;
+        long long error;
+        int heap_pos;
+        int length;
+        char key[MAX_KEY_LENGTH + 1];
+    };
+    
+    Counter* counters;
+    int* heap;
+    int* index;
+    int used;
+    
+    void swapHeap(int a, int b) {
+        int temp = heap[a];
+        heap[a] = heap[b];
+        heap[b] = temp;
+        counters[heap[a]].heap_pos = a;
+        counters[heap[b]].heap_pos = b;
+    }
+    
+    void siftUp(int pos) {
+        while (pos > 0) {
+            int parent = (pos - 1) / 2;
+            if (counters[heap[parent]].count <= counters[heap[pos]].count) return;
+            swapHeap(parent, pos);
+            pos = parent;
+        }
+    }
+    
+    void siftDown(int pos) {
+        while (true) {
+            int smallest = pos;
+            int left = pos * 2 + 1;
+            int right = left + 1;
+            if (left < used && counters[heap[left]].count < counters[heap[smallest]].count) smallest = left;
+            if (right < used && counters[heap[right]].count < counters[heap[smallest]].count) smallest = right;
+            if (smallest == pos) return;
+            swapHeap(pos, smallest);
+            pos = smallest;
+        }
+    }
+    
+    int find(const char* key, int len, unsigned long long hash) const {
+        for (int slot = (int)(hash & (INDEX_SIZE - 1)); index[slot] >= 0; slot = (slot + 1) & (INDEX_SIZE - 1)) {
+            const Counter& counter = counters[index[slot]];
+            if (counter.hash == hash && counter.length == len && myStrncmp(counter.key, key, len) == 0) {
+                return index[slot];
+            }
+        }
+        return -1;
+    }
+    
+    void insertIndex(int id) {
+        int slot = (int)(counters[id].hash & (INDEX_SIZE - 1));
+        while (index[slot] >= 0) slot = (slot + 1) & (INDEX_SIZE - 1);
+        index[slot] = id;
+    }
+    
+    void removeIndex(int id) {
+        int slot = (int)(counters[id].hash & (INDEX_SIZE - 1));
+        while (index[slot] != id) slot = (slot + 1) & (INDEX_SIZE - 1);
         
-        if (i >= len) break;
+        int hole = slot;
+        for (slot = (hole + 1) & (INDEX_SIZE - 1); index[slot] >= 0; slot = (slot + 1) & (INDEX_SIZE - 1)) {
+            int home = (int)(counters[index[slot]].hash & (INDEX_SIZE - 1));
+            if (((slot - home) & (INDEX_SIZE - 1)) >= ((slot - hole) & (INDEX_SIZE - 1))) {
+                index[hole] = index[slot];
+                hole = slot;
+            }
+        }
+        index[hole] = -1;
+    }
+    
+    void assign(int id, const char* key, int len, unsigned long long hash) {
+        counters[id].hash = hash;
+        counters[id].length = len;
+        for (int i = 0; i < len; i++) {
+            counters[id].key[i] = key[i];
+        }
+        counters[id].key[len] = '\0';
+    }
+    
+public:
+    SpaceSaving() : used(0) {
+        counters = new Counter[CAPACITY];
+        heap = new int[CAPACITY];
+        index = new int[INDEX_SIZE];
+        for (int i = 0; i < INDEX_SIZE; i++) {
+            index[i] = -1;
+        }
+    }
+    
+    ~SpaceSaving() {
+        delete[] counters;
+        delete[] heap;
+        delete[] index;
+    }
+    
+    void add(const char* key, int len, unsigned long long hash) {
+        if (len > MAX_KEY_LENGTH) return;
         
-        int start = i;
+        int id = find(key, len, hash);
+        if (id >= 0) {
+            counters[id].count++;
+            siftDown(counters[id].heap_pos);
+            return;
+        }
         
-        while (i < len && !isDelimiter(text[i])) {
-            i++;
+        if (used < CAPACITY) {
+            id = used;
+            assign(id, key, len, hash);
+            counters[id].count = 1;
+            counters[id].error = 0;
+            counters[id].heap_pos = used;
+            heap[used++] = id;
+            insertIndex(id);
+            siftUp(counters[id].heap_pos);
+            return;
         }
         
-        int token_len = i - start;
-        if (token_len > 0 && token_len < 50) {
-            char* token_text = new char[token_len + 1];
-            for (int j = 0; j < token_len; j++) {
-                token_text[j] = text[start + j];
-            }
-            token_text[token_len] = '\0';
-            
-            toLowerCase(token_text);
-            
-            if (!isJunkToken(token_text)) {
-                hashmap.addToken(token_text, token_len);
-            }
-            
-            delete[] token_text;
+        id = heap[0];
+        removeIndex(id);
+        counters[id].error = counters[id].count;
+        counters[id].count++;
+        assign(id, key, len, hash);
+        insertIndex(id);
+        siftDown(0);
+    }
+    
+    int getUsed() const { return used; }
+    bool isFull() const { return used == CAPACITY; }
+    const char* getKey(int id) const { return counters[id].key; }
+    unsigned long long getHash(int id) const { return counters[id].hash; }
+    long long getCount(int id) const { return counters[id].count; }
+    long long getError(int id) const { return counters[id].error; }
+    long long getBytes() const { return (long long)CAPACITY * (sizeof(Counter) + sizeof(int)) + INDEX_SIZE * sizeof(int); }
+};
+
+class HyperLogLog {
+private:
+    static const int PRECISION = 14;
+    static const int REGISTERS = 1 << PRECISION;
+    
+    unsigned char registers[REGISTERS];
+    
+public:
+    HyperLogLog() {
+        for (int i = 0; i < REGISTERS; i++) {
+            registers[i] = 0;
         }
     }
-}
+    
+    void add(unsigned long long hash) {
+        int reg = (int)(hash >> (64 - PRECISION));
+        unsigned long long rest = (hash << PRECISION) | (1ULL << (PRECISION - 1));
+        unsigned char rank = (unsigned char)(__builtin_clzll(rest) + 1);
+        if (rank > registers[reg]) registers[reg] = rank;
+    }
+    
+    double estimate() const {
+        double sum = 0;
+        int zeros = 0;
+        for (int i = 0; i < REGISTERS; i++) {
+            sum += 1.0 / (double)(1ULL << registers[i]);
+            if (registers[i] == 0) zeros++;
+        }
+        
+        double alpha = 0.7213 / (1 + 1.079 / REGISTERS);
+        double raw = alpha * REGISTERS * REGISTERS / sum;
+        if (raw <= 2.5 * REGISTERS && zeros > 0) {
+            return REGISTERS * myLog((double)REGISTERS / zeros);
+        }
+        return raw;
+    }
+    
+    long long getBytes() const { return REGISTERS; }
+};
 
-void tokenizeWithStemming(const char* text, HashMap& hashmap, RussianStemmer& stemmer) {
-    int i = 0;
-    int len = myStrlen(text);
+class FrequencySketch {
+private:
+    CountMinSketch count_min;
+    SpaceSaving heavy_hitters;
+    HyperLogLog unique;
+    long long total;
+    
+public:
+    FrequencySketch() : total(0) {}
+    
+    void add(const char* token, int len) {
+        unsigned long long hash = hashBytes64(token, len);
+        count_min.add(hash);
+        heavy_hitters.add(token, len, hash);
+        unique.add(hash);
+        total++;
+    }
+    
+    FreqPair* topK(int k) const {
+        int candidates = heavy_hitters.getUsed();
+        FreqPair* array = new FreqPair[candidates > 0 ? candidates : 1];
+        for (int i = 0; i < candidates; i++) {
+            long long count = heavy_hitters.getCount(i);
+            long long sketched = count_min.estimate(heavy_hitters.getHash(i));
+            array[i].text = heavy_hitters.getKey(i);
+            array[i].freq = (int)(sketched < count ? sketched : count);
+        }
+        FreqPair* top = selectTopK(array, candidates, k);
+        delete[] array;
+        return top;
+    }
+    
+    long long getTotal() const { return total; }
     
-    while (i < len) {
-        while (i < len && isDelimiter(text[i])) {
-            i++;
+    int getUniqueEstimate() const {
+        if (!heavy_hitters.isFull()) return heavy_hitters.getUsed();
+        int estimate = (int)(unique.estimate() + 0.5);
+        return estimate > heavy_hitters.getUsed() ? estimate : heavy_hitters.getUsed();
+    }
+
+    int getCandidateCount() const { return heavy_hitters.getUsed(); }
+    bool isSaturated() const { return heavy_hitters.isFull(); }
+    long long getBytes() const { return count_min.getBytes() + heavy_hitters.getBytes() + unique.getBytes(); }
+};
+
+class MappedFile {
+private:
+    int fd;
+    const char* data;
+    long long size;
+    
+public:
+    MappedFile() : fd(-1), data(nullptr), size(0) {}
+    
+    ~MappedFile() {
+        close();
+    }
+    
+    bool open(const char* filename) {
+        fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Не могу открыть файл: " << filename << std::endl;
+            return false;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            std::cerr << "Пустой или недоступный файл: " << filename << std::endl;
+            close();
+            return false;
         }
+        size = st.st_size;
         
-        if (i >= len) break;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Ошибка mmap: " << filename << std::endl;
+            close();
+            return false;
+        }
         
-        int start = i;
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*)mapped;
+        return true;
+    }
+    
+    void close() {
+        if (data) {
+            munmap((void*)data, size);
+            data = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        size = 0;
+    }
+    
+    const char* getData() const { return data; }
+    long long getSize() const { return size; }
+};
+
+/*
+Потоковое чтение корпуса окнами фиксированного размера. Окно отдаётся
+анализатору только до начала последней статьи в нём; незавершённая статья
+(вместе с оборванными токенами и тегами) переносится в начало следующего
+окна. Если в окно не помещается ни одной целой статьи, буфер удваивается,
+так что память ограничена размером окна и самой длинной статьёй.
+*/
+
+const long long DEFAULT_STREAM_WINDOW = 64LL * 1024 * 1024;
+
+class CorpusStream {
+private:
+    int fd;
+    char* buffer;
+    long long capacity;
+    long long filled;
+    long long consumed;
+    long long bytes_read;
+    bool eof;
+    
+    long long lastArticleStart() const {
+        for (long long pos = filled - 8; pos > 0; pos--) {
+            if (buffer[pos] == '<' && myStrncmp(buffer + pos, "<article", 8) == 0) {
+                return pos;
+            }
+        }
+        return 0;
+    }
+    
+    void fill() {
+        while (!eof && filled < capacity) {
+            ssize_t got = ::read(fd, buffer + filled, capacity - filled);
+            if (got <= 0) {
+                eof = true;
+                break;
+            }
+            filled += got;
+            bytes_read += got;
+        }
+    }
+    
+public:
+    CorpusStream() : fd(-1), buffer(nullptr), capacity(0), filled(0), consumed(0),
+                     bytes_read(0), eof(false) {}
+    
+    ~CorpusStream() {
+        close();
+    }
+    
+    bool open(const char* filename, long long window_bytes) {
+        fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Не могу открыть файл: " << filename << std::endl;
+            return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
         
-        while (i < len && !isDelimiter(text[i])) {
-            i++;
+        capacity = window_bytes;
+        buffer = new char[capacity];
+        filled = 0;
+        consumed = 0;
+        bytes_read = 0;
+        eof = false;
+        return true;
+    }
+    
+    bool nextSegment(const char*& data, long long& size) {
+        if (consumed > 0) {
+            for (long long i = consumed; i < filled; i++) {
+                buffer[i - consumed] = buffer[i];
+            }
+            filled -= consumed;
+            consumed = 0;
+            posix_fadvise(fd, 0, bytes_read - filled, POSIX_FADV_DONTNEED);
         }
         
-        int token_len = i - start;
-        if (token_len > 0 && token_len < 50) {
-            char* token_text = new char[token_len + 1];
-            for (int j = 0; j < token_len; j++) {
-                token_text[j] = text[start + j];
+        while (true) {
+            fill();
+            
+            if (eof) {
+                if (filled == 0) return false;
+                consumed = filled;
+                break;
+            }
+            
+            consumed = lastArticleStart();
+            if (consumed > 0) break;
+            
+            char* grown = new char[capacity * 2];
+            for (long long i = 0; i < filled; i++) {
+                grown[i] = buffer[i];
             }
-            token_text[token_len] = '\0';
+            delete[] buffer;
+            buffer = grown;
+            capacity *= 2;
+        }
+        
+        data = buffer;
+        size = consumed;
+        return true;
+    }
+    
+    void close() {
+        delete[] buffer;
+        buffer = nullptr;
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    
+    long long getBytesRead() const { return bytes_read; }
+    long long getBufferSize() const { return capacity; }
+};
+
+int extractArticleId(const char* xml, long long start_pos, long long xml_size) {
+    long long pos = start_pos;
+    
+    
+    long long search_limit = pos + 100;
+    if (search_limit > xml_size) search_limit = xml_size;
+    
+    while (pos < search_limit) {
+        if (pos + 4 <= xml_size && myStrncmp(xml + pos, "id=\"", 4) == 0) {
+            pos += 4; 
             
-            toLowerCase(token_text);
             
-            if (!isJunkToken(token_text)) {
-                const char* stem = stemmer.stem(token_text);
-                hashmap.addToken(stem, myStrlen(stem));
+            int id = 0;
+            while (pos < xml_size && xml[pos] >= '0' && xml[pos] <= '9') {
+                id = id * 10 + (xml[pos] - '0');
+                pos++;
             }
             
-            delete[] token_text;
+            return id;
         }
+        pos++;
     }
+    
+    return -1; 
 }
 
-double calculateZipfConstant(int total_tokens, int unique_tokens) {
-    double harmonic = 0;
-    for (int i = 1; i <= unique_tokens; i++) {
-        harmonic += 1.0 / i;
+
+struct ArticleSpan {
+    int doc_id;
+    const char* content_begin;
+    const char* content_end;
+};
+
+class CorpusView {
+private:
+    ArticleSpan* spans;
+    int capacity;
+    int count;
+    long long content_bytes;
+    
+    void addSpan(int doc_id, const char* begin, const char* end) {
+        if (count >= capacity) {
+            capacity *= 2;
+            ArticleSpan* new_spans = new ArticleSpan[capacity];
+            for (int i = 0; i < count; i++) {
+                new_spans[i] = spans[i];
+            }
+            delete[] spans;
+            spans = new_spans;
+        }
+        spans[count].doc_id = doc_id;
+        spans[count].content_begin = begin;
+        spans[count].content_end = end;
+        content_bytes += end - begin;
+        count++;
     }
-    return total_tokens / harmonic;
-}
+    
+public:
+    CorpusView() : capacity(1024), count(0), content_bytes(0) {
+        spans = new ArticleSpan[capacity];
+    }
+    
+    ~CorpusView() {
+        delete[] spans;
+    }
+    
+    void build(const char* xml_content, long long xml_size) {
+        const char* ptr = xml_content;
+        const char* end = xml_content + xml_size;
+        
+        while (ptr < end) {
+            if (end - ptr < 8 || myStrncmp(ptr, "<article", 8) != 0) {
+                ptr++;
+                continue;
+            }
+            
+            int doc_id = extractArticleId(xml_content, ptr - xml_content, xml_size);
+            if (doc_id == -1) {
+                ptr++;
+                continue;
+            }
+            
+            const char* content_start = ptr;
+            while (content_start < end && (end - content_start < 9 || myStrncmp(content_start, "<content>", 9) != 0)) {
+                content_start++;
+                
+                if (end - content_start >= 8 && myStrncmp(content_start, "<article", 8) == 0) {
+                    break;
+                }
+            }
+            
+            if (end - content_start < 9 || myStrncmp(content_start, "<content>", 9) != 0) {
+                ptr++;
+                continue;
+            }
+            
+            content_start += 9;
+            
+            const char* content_end = content_start;
+            while (content_end < end && (end - content_end < 10 || myStrncmp(content_end, "</content>", 10) != 0)) {
+                content_end++;
+            }
+            
+            addSpan(doc_id, content_start, content_end);
+            
+            ptr = content_end + 10;
+        }
+    }
+    
+    void retain(const bool* keep) {
+        int kept = 0;
+        content_bytes = 0;
+        for (int i = 0; i < count; i++) {
+            if (keep[i]) {
+                spans[kept++] = spans[i];
+                content_bytes += spans[i].content_end - spans[i].content_begin;
+            }
+        }
+        count = kept;
+    }
+    
+    int getCount() const { return count; }
+    long long getContentBytes() const { return content_bytes; }
+    const ArticleSpan& get(int index) const { return spans[index]; }
+};
 
-void analyzeZipfLaw(FreqPair* freq_array, int unique_tokens, int total_tokens, const char* title) {
-    std::cout << "\n=== " << title << " ===" << std::endl;
+/*
+Манифест статей для инкрементальной токенизации: для каждого doc_id
+хранятся длина и 64-битный отпечаток текста <content>. При повторном
+запуске с --incremental статьи с тем же отпечатком пропускаются, в поток
+попадают только новые и изменённые, а doc_id, пропавшие из корпуса,
+записываются как удалённые. Манифест описывает содержимое tokens.bin и
+обновляется только после того, как дельта к нему применена.
+
+Почти-дубликат из tokens.bin зависит от своей канонической статьи: если
+она изменилась или пропала, дубликат тоже идёт в дельту и проверяется
+заново, иначе пара исчезла бы вместе с прежней версией канонической.
+
+ФОРМАТ TOKENS.MANIFEST: "TKMF", VERSION (uint32), COUNT (uint32), затем
+COUNT записей по возрастанию doc_id: DOC_ID (uint32), LENGTH (uint32),
+FINGERPRINT (uint64).
+*/
+
+const unsigned int MANIFEST_VERSION = 1;
+
+struct ManifestEntry {
+    int doc_id;
+    unsigned int length;
+    unsigned long long fingerprint;
+};
+
+class ArticleManifest {
+private:
+    ManifestEntry* entries;
+    int capacity;
+    int count;
     
-    double C = calculateZipfConstant(total_tokens, unique_tokens);
-    std::cout << "Константа Ципфа C = " << (int)C << std::endl;
+    static unsigned int readUInt32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
     
-    std::cout << "\nСРАВНЕНИЕ РЕАЛЬНЫХ И ПРЕДСКАЗАННЫХ ЧАСТОТ:" << std::endl;
-    std::cout << "Ранг\tТокен\t\t\tРеальная\tЦипф\tОтклонение\tlog(Ранг)\tlog(Частота)" << std::endl;
-    std::cout << "---------------------------------------------------------------------------------" << std::endl;
+    static void putUInt32(unsigned char* p, unsigned int value) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (unsigned char)((value >> (i * 8)) & 0xFF);
+        }
+    }
     
-    double total_deviation = 0;
-    int compare_count = (unique_tokens < 50) ? unique_tokens : 50;
+public:
+    ArticleManifest() : capacity(1024), count(0) {
+        entries = new ManifestEntry[capacity];
+    }
     
-    for (int i = 0; i < compare_count; i++) {
-        int rank = i + 1;
-        int real_freq = freq_array[i].freq;
-        double zipf_freq = C / rank;
-        double deviation = (real_freq - zipf_freq) / zipf_freq * 100;
-        total_deviation += fabs(deviation);
+    ~ArticleManifest() {
+        delete[] entries;
+    }
+    
+    void add(int doc_id, unsigned int length, unsigned long long fingerprint) {
+        if (count >= capacity) {
+            capacity *= 2;
+            ManifestEntry* new_entries = new ManifestEntry[capacity];
+            for (int i = 0; i < count; i++) {
+                new_entries[i] = entries[i];
+            }
+            delete[] entries;
+            entries = new_entries;
+        }
+        entries[count].doc_id = doc_id;
+        entries[count].length = length;
+        entries[count].fingerprint = fingerprint;
+        count++;
+    }
+    
+    void sortByDocId() {
+        ManifestEntry* buffer = new ManifestEntry[count > 0 ? count : 1];
+        ManifestEntry* src = entries;
+        ManifestEntry* dst = buffer;
+        for (int width = 1; width < count; width *= 2) {
+            for (int left = 0; left < count; left += 2 * width) {
+                int mid = (left + width < count) ? left + width : count;
+                int right = (left + 2 * width < count) ? left + 2 * width : count;
+                int i = left, j = mid, k = left;
+                while (i < mid && j < right) {
+                    dst[k++] = (src[j].doc_id < src[i].doc_id) ? src[j++] : src[i++];
+                }
+                while (i < mid) dst[k++] = src[i++];
+                while (j < right) dst[k++] = src[j++];
+            }
+            ManifestEntry* tmp = src;
+            src = dst;
+            dst = tmp;
+        }
+        if (src != entries) {
+            for (int i = 0; i < count; i++) {
+                entries[i] = src[i];
+            }
+        }
+        delete[] buffer;
+    }
+    
+    int find(int doc_id) const {
+        int low = 0;
+        int high = count - 1;
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            if (entries[mid].doc_id == doc_id) return mid;
+            if (entries[mid].doc_id < doc_id) low = mid + 1;
+            else high = mid - 1;
+        }
+        return -1;
+    }
+    
+    bool load(const char* filename) {
+        if (access(filename, F_OK) != 0) return false;
         
-        double log_rank = myLog((double)rank);
-        double log_freq = myLog((double)real_freq);
+        MappedFile file;
+        if (!file.open(filename)) return false;
         
-        std::cout << rank << "\t" << freq_array[i].text;
+        const unsigned char* data = (const unsigned char*)file.getData();
+        if (file.getSize() < 12 || data[0] != 'T' || data[1] != 'K' || data[2] != 'M' || data[3] != 'F' ||
+            readUInt32(data + 4) != MANIFEST_VERSION) {
+            std::cerr << "Неверный формат манифеста: " << filename << std::endl;
+            return false;
+        }
         
-        int token_len = myStrlen(freq_array[i].text);
-        if (token_len < 8) std::cout << "\t\t\t";
-        else if (token_len < 16) std::cout << "\t\t";
-        else std::cout << "\t";
+        unsigned int stored = readUInt32(data + 8);
+        if ((unsigned long long)file.getSize() < 12 + (unsigned long long)stored * 16) {
+            std::cerr << "Манифест обрезан: " << filename << std::endl;
+            return false;
+        }
         
-        std::cout << real_freq << "\t" << (int)zipf_freq << "\t" 
-                  << deviation << "%\t" << log_rank << "\t" << log_freq << std::endl;
+        const unsigned char* p = data + 12;
+        for (unsigned int i = 0; i < stored; i++) {
+            add((int)readUInt32(p), readUInt32(p + 4),
+                readUInt32(p + 8) | ((unsigned long long)readUInt32(p + 12) << 32));
+            p += 16;
+        }
+        sortByDocId();
+        return true;
     }
     
-    std::cout << "\nСредняя абсолютная ошибка: " 
-              << total_deviation / compare_count << "%" << std::endl;
+    bool save(const char* filename) {
+        sortByDocId();
+        
+        char temp_name[512];
+        int len = myStrlen(filename);
+        if (len > 500) len = 500;
+        for (int i = 0; i < len; i++) {
+            temp_name[i] = filename[i];
+        }
+        myStrcpy(temp_name + len, ".tmp");
+        
+        FILE* file = fopen(temp_name, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла " << temp_name << std::endl;
+            return false;
+        }
+        
+        unsigned char record[16];
+        fwrite("TKMF", 1, 4, file);
+        putUInt32(record, MANIFEST_VERSION);
+        putUInt32(record + 4, count);
+        fwrite(record, 1, 8, file);
+        for (int i = 0; i < count; i++) {
+            putUInt32(record, entries[i].doc_id);
+            putUInt32(record + 4, entries[i].length);
+            putUInt32(record + 8, (unsigned int)entries[i].fingerprint);
+            putUInt32(record + 12, (unsigned int)(entries[i].fingerprint >> 32));
+            fwrite(record, 1, 16, file);
+        }
+        
+        bool ok = fflush(file) == 0;
+        fclose(file);
+        if (!ok || rename(temp_name, filename) != 0) {
+            std::cerr << "Ошибка записи манифеста " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    int getCount() const { return count; }
+    const ManifestEntry& get(int index) const { return entries[index]; }
+};
+
+class IncrementalTracker {
+private:
+    ArticleManifest previous;
+    ArticleManifest current;
+    bool* seen;
+    bool* reused;
+    int* canonicals;
+    int* reused_ids;
+    int* reused_next;
+    int reused_count;
+    bool incremental;
+    int added;
+    int changed;
+    int unchanged;
+    int requeued;
+    
+public:
+    IncrementalTracker() : seen(nullptr), reused(nullptr), canonicals(nullptr), reused_ids(nullptr),
+                           reused_next(nullptr), reused_count(0), incremental(false),
+                           added(0), changed(0), unchanged(0), requeued(0) {}
+    
+    ~IncrementalTracker() {
+        delete[] seen;
+        delete[] reused;
+        delete[] canonicals;
+        delete[] reused_ids;
+        delete[] reused_next;
+    }
+    
+    bool loadPrevious(const char* filename) {
+        incremental = previous.load(filename);
+        int size = previous.getCount() > 0 ? previous.getCount() : 1;
+        seen = new bool[size];
+        reused = new bool[size];
+        canonicals = new int[size];
+        for (int i = 0; i < previous.getCount(); i++) {
+            seen[i] = false;
+            reused[i] = false;
+            canonicals[i] = -1;
+        }
+        return incremental;
+    }
+    
+    // Пары (doc_id, канонический doc_id) из прежнего tokens.bin
+    void setDuplicates(const int* pairs, int count) {
+        for (int i = 0; i < count; i++) {
+            int old = previous.find(pairs[i * 2]);
+            if (old >= 0) canonicals[old] = pairs[i * 2 + 1];
+        }
+    }
+    
+    void select(CorpusView& view) {
+        bool* keep = new bool[view.getCount() > 0 ? view.getCount() : 1];
+        delete[] reused_ids;
+        delete[] reused_next;
+        reused_ids = new int[view.getCount() > 0 ? view.getCount() : 1];
+        reused_next = new int[view.getCount() > 0 ? view.getCount() : 1];
+        reused_count = 0;
+        for (int i = 0; i < view.getCount(); i++) {
+            const ArticleSpan& article = view.get(i);
+            unsigned int length = (unsigned int)(article.content_end - article.content_begin);
+            unsigned long long fingerprint = hashBytes64(article.content_begin, (int)length) ^ length;
+            current.add(article.doc_id, length, fingerprint);
+            
+            int old = incremental ? previous.find(article.doc_id) : -1;
+            if (old < 0) {
+                added++;
+                keep[i] = true;
+            } else {
+                const ManifestEntry& entry = previous.get(old);
+                keep[i] = entry.length != length || entry.fingerprint != fingerprint;
+                if (keep[i]) {
+                    changed++;
+                } else if (canonicals[old] >= 0 && !isReused(canonicals[old])) {
+                    // каноническая изменена, удалена или ещё не встречалась
+                    keep[i] = true;
+                    requeued++;
+                } else {
+                    unchanged++;
+                    reused[old] = true;
+                    reused_ids[reused_count++] = article.doc_id;
+                }
+                seen[old] = true;
+            }
+        }
+        
+        int next_kept = -1;
+        for (int i = view.getCount() - 1, r = reused_count; i >= 0; i--) {
+            if (keep[i]) next_kept = view.get(i).doc_id;
+            else reused_next[--r] = next_kept;
+        }
+        view.retain(keep);
+        delete[] keep;
+    }
+    
+    int* collectDeleted(int& deleted) const {
+        deleted = 0;
+        for (int i = 0; i < previous.getCount(); i++) {
+            if (!seen[i]) deleted++;
+        }
+        int* ids = new int[deleted > 0 ? deleted : 1];
+        int n = 0;
+        for (int i = 0; i < previous.getCount(); i++) {
+            if (!seen[i]) ids[n++] = previous.get(i).doc_id;
+        }
+        return ids;
+    }
+    
+    bool isReused(int doc_id) const {
+        int old = previous.find(doc_id);
+        return old >= 0 && reused[old];
+    }
+    
+    bool save(const char* filename) { return current.save(filename); }
+    
+    bool isIncremental() const { return incremental; }
+    int getAdded() const { return added; }
+    int getChanged() const { return changed; }
+    int getUnchanged() const { return unchanged; }
+    int getRequeued() const { return requeued; }
+    // Неизменённые статьи последнего окна и doc_id следующей токенизируемой
+    const int* getReusedIds() const { return reused_ids; }
+    const int* getReusedNext() const { return reused_next; }
+    int getReusedCount() const { return reused_count; }
+};
+
+/*
+Приведение к нижнему регистру для латиницы, кириллицы и Ё. Каждый байт
+сворачивается независимо по тройке (предыдущий, текущий, следующий):
+заглавная кириллица D0 90..AF и D0 81 превращается в D0 B0..BF, D1 80..8F
+и D1 91, поэтому ведущий D0 меняется на D1 по следующему байту, а
+продолжение - по тому, что перед ним стоит D0. Продолжения никогда не
+равны D0 и не бывают ASCII, так что правило не зависит от разбора пар.
+Векторные ядра обрабатывают по 16/32 байт, хвост - две таблицы по 256;
+без SSE4.2 весь текст сворачивается по таблицам.
+*/
+
+class CaseFolder {
+private:
+    typedef int (*BlockFolder)(unsigned char* str, int len, unsigned char& prev);
+    
+    BlockFolder fold_blocks;
+    const char* backend;
+    
+    static int foldBlocksSSE(unsigned char* str, int len, unsigned char& prev);
+    static int foldBlocksAVX2(unsigned char* str, int len, unsigned char& prev);
+    
+    unsigned char fold_table[2][256];
+    unsigned char lead_flip[256];
+    
+public:
+    CaseFolder() {
+        for (int c = 0; c < 256; c++) {
+            unsigned char plain = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+            fold_table[0][c] = plain;
+            fold_table[1][c] = plain;
+            if (c >= 0x90 && c <= 0x9F) fold_table[1][c] = c + 0x20;
+            if (c >= 0xA0 && c <= 0xAF) fold_table[1][c] = c - 0x20;
+            if (c == 0x81) fold_table[1][c] = 0x91;
+            lead_flip[c] = ((c >= 0xA0 && c <= 0xAF) || c == 0x81) ? 0x01 : 0x00;
+        }
+        
+        fold_blocks = nullptr;
+        backend = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            fold_blocks = foldBlocksAVX2;
+            backend = "AVX2";
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            fold_blocks = foldBlocksSSE;
+            backend = "SSE4.2";
+        }
+#endif
+    }
+    
+    const char* getBackend() const { return backend; }
+    
+    void fold(char* text, int len) const {
+        unsigned char* str = (unsigned char*)text;
+        unsigned char prev = 0;
+        int i = fold_blocks ? fold_blocks(str, len, prev) : 0;
+        for (; i < len; i++) {
+            unsigned char c = str[i];
+            unsigned char next = (i + 1 < len) ? str[i + 1] : 0;
+            str[i] = fold_table[prev == 0xD0][c] ^ (lead_flip[next] & -(unsigned char)(c == 0xD0));
+            prev = c;
+        }
+    }
+};
+
+const CaseFolder caseFolder;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static inline __m128i inRange(__m128i bytes, unsigned char low, unsigned char width) {
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8((char)low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8((char)width)), shifted);
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i foldVector(__m128i cur, __m128i before, __m128i next) {
+    __m128i after_lead = _mm_cmpeq_epi8(before, _mm_set1_epi8((char)0xD0));
+    __m128i lead = _mm_and_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8((char)0xD0)),
+                                 _mm_or_si128(inRange(next, 0xA0, 15), _mm_cmpeq_epi8(next, _mm_set1_epi8((char)0x81))));
+    
+    __m128i delta = _mm_and_si128(inRange(cur, 'A', 25), _mm_set1_epi8(0x20));
+    __m128i continuation = _mm_and_si128(inRange(cur, 0x90, 15), _mm_set1_epi8(0x20));
+    continuation = _mm_or_si128(continuation, _mm_and_si128(inRange(cur, 0xA0, 15), _mm_set1_epi8((char)0xE0)));
+    continuation = _mm_or_si128(continuation, _mm_and_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8((char)0x81)), _mm_set1_epi8(0x10)));
+    delta = _mm_or_si128(delta, _mm_and_si128(after_lead, continuation));
+    delta = _mm_or_si128(delta, _mm_and_si128(lead, _mm_set1_epi8(0x01)));
+    return _mm_add_epi8(cur, delta);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRange(__m256i bytes, unsigned char low, unsigned char width) {
+    __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8((char)low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8((char)width)), shifted);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i foldVector(__m256i cur, __m256i before, __m256i next) {
+    __m256i after_lead = _mm256_cmpeq_epi8(before, _mm256_set1_epi8((char)0xD0));
+    __m256i lead = _mm256_and_si256(_mm256_cmpeq_epi8(cur, _mm256_set1_epi8((char)0xD0)),
+                                    _mm256_or_si256(inRange(next, 0xA0, 15), _mm256_cmpeq_epi8(next, _mm256_set1_epi8((char)0x81))));
+    
+    __m256i delta = _mm256_and_si256(inRange(cur, 'A', 25), _mm256_set1_epi8(0x20));
+    __m256i continuation = _mm256_and_si256(inRange(cur, 0x90, 15), _mm256_set1_epi8(0x20));
+    continuation = _mm256_or_si256(continuation, _mm256_and_si256(inRange(cur, 0xA0, 15), _mm256_set1_epi8((char)0xE0)));
+    continuation = _mm256_or_si256(continuation, _mm256_and_si256(_mm256_cmpeq_epi8(cur, _mm256_set1_epi8((char)0x81)), _mm256_set1_epi8(0x10)));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(after_lead, continuation));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(lead, _mm256_set1_epi8(0x01)));
+    return _mm256_add_epi8(cur, delta);
+}
+
+__attribute__((target("sse4.2")))
+int CaseFolder::foldBlocksSSE(unsigned char* str, int len, unsigned char& prev) {
+    int i = 0;
+    __m128i previous = _mm_insert_epi8(_mm_setzero_si128(), prev, 15);
+    while (len - i > 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(str + i));
+        __m128i next = _mm_loadu_si128((const __m128i*)(str + i + 1));
+        __m128i before = _mm_alignr_epi8(cur, previous, 15);
+        _mm_storeu_si128((__m128i*)(str + i), foldVector(cur, before, next));
+        previous = cur;
+        i += 16;
+    }
+    prev = (unsigned char)_mm_extract_epi8(previous, 15);
+    return i;
+}
+
+__attribute__((target("avx2")))
+int CaseFolder::foldBlocksAVX2(unsigned char* str, int len, unsigned char& prev) {
+    int i = 0;
+    __m256i previous = _mm256_insert_epi8(_mm256_setzero_si256(), prev, 31);
+    while (len - i > 32) {
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(str + i + 1));
+        __m256i before = _mm256_alignr_epi8(cur, _mm256_permute2x128_si256(previous, cur, 0x21), 15);
+        
+        _mm256_storeu_si256((__m256i*)(str + i), foldVector(cur, before, next));
+        previous = cur;
+        i += 32;
+    }
+    prev = (unsigned char)_mm256_extract_epi8(previous, 31);
+    return i + foldBlocksSSE(str + i, len - i, prev);
+}
+#endif
+
+void toLowerCase(char* str, int len) {
+    caseFolder.fold(str, len);
+}
+
+void toLowerCase(char* str) {
+    toLowerCase(str, myStrlen(str));
+}
+
+bool isDelimiter(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || 
+           c == ',' || c == '.' || c == '!' || c == '?' || 
+           c == ';' || c == ':' || c == '(' || c == ')' ||
+           c == '[' || c == ']' || c == '"' || c == '\'' ||
+           c == '-' || c == '_' || c == '/' || c == '\\';
+}
+
+/*
+Фильтр мусорных токенов. Список слов читается из файла (по одному в строке,
+'#' - комментарий) и компилируется в совершенный хеш по схеме
+"hash and displace": слово попадает в корзину по своему хешу, а для каждой
+корзины подбирается сдвиг, при котором все её слова ложатся в свободные
+слоты таблицы. Перед обращением к таблице токен проверяется по блочному
+фильтру Блума - одно 64-битное слово на проверку.
+*/
+
+const char* const DEFAULT_JUNK_TOKENS[] = {
+    "http", "https", "www", "html", "xml", 
+    "url", "content", "statistics", "character_count",
+    "word_count", "article", "source", "id", "meta",
+    "total_articles", "generated_date", "cdata", 
+    "&lt", "&gt", "&amp", "&quot", "]]&gt", "<![cdata[",
+    "f1news", "ru", "news", "f1", NULL
+};
+
+class JunkFilter {
+private:
+    struct Entry {
+        const char* text;
+        int length;
+        unsigned int hash;
+    };
+    
+    static const int BLOOM_WORDS = 64;
+    static const int MAX_SEED = 1 << 20;
+    
+    Arena arena;
+    Entry* words;
+    int word_count;
+    int word_capacity;
+    
+    unsigned long long bloom[BLOOM_WORDS];
+    Entry* slots;
+    unsigned int slot_mask;
+    unsigned int* seeds;
+    unsigned int bucket_count;
+    
+    static unsigned int slotHash(unsigned int hash, unsigned int seed) {
+        unsigned int x = hash ^ (seed * 0x9E3779B9u);
+        x ^= x >> 15;
+        x *= 0x2C1B3C6Du;
+        x ^= x >> 12;
+        return x;
+    }
+    
+    static unsigned long long bloomBits(unsigned int hash) {
+        return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63));
+    }
+    
+    bool place(unsigned int table_size) {
+        delete[] slots;
+        delete[] seeds;
+        slot_mask = table_size - 1;
+        bucket_count = (word_count + 3) / 4;
+        slots = new Entry[table_size];
+        seeds = new unsigned int[bucket_count];
+        for (unsigned int i = 0; i < table_size; i++) {
+            slots[i].text = nullptr;
+        }
+        
+        int* bucket_size = new int[bucket_count + 1];
+        for (unsigned int b = 0; b <= bucket_count; b++) {
+            bucket_size[b] = 0;
+            if (b < bucket_count) seeds[b] = 0;
+        }
+        for (int i = 0; i < word_count; i++) {
+            bucket_size[words[i].hash % bucket_count + 1]++;
+        }
+        for (unsigned int b = 0; b < bucket_count; b++) {
+            bucket_size[b + 1] += bucket_size[b];
+        }
+        int* members = new int[word_count];
+        int* fill = new int[bucket_count];
+        for (unsigned int b = 0; b < bucket_count; b++) {
+            fill[b] = bucket_size[b];
+        }
+        for (int i = 0; i < word_count; i++) {
+            members[fill[words[i].hash % bucket_count]++] = i;
+        }
+        
+        int* order = new int[bucket_count];
+        int max_size = 0;
+        for (unsigned int b = 0; b < bucket_count; b++) {
+            order[b] = b;
+            int size = bucket_size[b + 1] - bucket_size[b];
+            if (size > max_size) max_size = size;
+        }
+        for (unsigned int i = 1; i < bucket_count; i++) {
+            int b = order[i];
+            int size = bucket_size[b + 1] - bucket_size[b];
+            int j = i - 1;
+            while (j >= 0 && bucket_size[order[j] + 1] - bucket_size[order[j]] < size) {
+                order[j + 1] = order[j];
+                j--;
+            }
+            order[j + 1] = b;
+        }
+        
+        unsigned int* taken = new unsigned int[max_size > 0 ? max_size : 1];
+        bool placed = true;
+        for (unsigned int k = 0; k < bucket_count && placed; k++) {
+            int b = order[k];
+            int first = bucket_size[b];
+            int size = bucket_size[b + 1] - first;
+            if (size == 0) break;
+            
+            placed = false;
+            for (unsigned int seed = 0; seed < MAX_SEED && !placed; seed++) {
+                placed = true;
+                for (int m = 0; m < size && placed; m++) {
+                    unsigned int slot = slotHash(words[members[first + m]].hash, seed) & slot_mask;
+                    if (slots[slot].text) placed = false;
+                    for (int p = 0; p < m && placed; p++) {
+                        if (taken[p] == slot) placed = false;
+                    }
+                    taken[m] = slot;
+                }
+                if (placed) {
+                    seeds[b] = seed;
+                    for (int m = 0; m < size; m++) {
+                        slots[taken[m]] = words[members[first + m]];
+                    }
+                }
+            }
+        }
+        
+        delete[] taken;
+        delete[] order;
+        delete[] fill;
+        delete[] members;
+        delete[] bucket_size;
+        return placed;
+    }
+    
+public:
+    JunkFilter() : words(nullptr), word_count(0), word_capacity(0),
+                   slots(nullptr), slot_mask(0), seeds(nullptr), bucket_count(0) {
+        for (int i = 0; i < BLOOM_WORDS; i++) {
+            bloom[i] = 0;
+        }
+    }
+    
+    ~JunkFilter() {
+        delete[] words;
+        delete[] slots;
+        delete[] seeds;
+    }
+    
+    void add(const char* word, int len) {
+        if (len <= 0) return;
+        unsigned int hash = hashBytes(word, len);
+        for (int i = 0; i < word_count; i++) {
+            if (words[i].hash == hash && words[i].length == len && myStrcmp(words[i].text, word)) return;
+        }
+        
+        if (word_count >= word_capacity) {
+            word_capacity = word_capacity ? word_capacity * 2 : 64;
+            Entry* grown = new Entry[word_capacity];
+            for (int i = 0; i < word_count; i++) {
+                grown[i] = words[i];
+            }
+            delete[] words;
+            words = grown;
+        }
+        
+        words[word_count].text = arena.copyString(word, len);
+        words[word_count].length = len;
+        words[word_count].hash = hash;
+        word_count++;
+    }
+    
+    void addDefaults() {
+        for (int i = 0; DEFAULT_JUNK_TOKENS[i] != NULL; i++) {
+            add(DEFAULT_JUNK_TOKENS[i], myStrlen(DEFAULT_JUNK_TOKENS[i]));
+        }
+    }
+    
+    bool loadFile(const char* filename) {
+        FILE* file = fopen(filename, "rb");
+        if (!file) return false;
+        
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            int start = 0;
+            while (line[start] == ' ' || line[start] == '\t') start++;
+            if (line[start] == '#') continue;
+            
+            int end = start;
+            while (line[end] != '\0' && line[end] != '\n' && line[end] != '\r' &&
+                   line[end] != ' ' && line[end] != '\t') {
+                end++;
+            }
+            line[end] = '\0';
+            
+            toLowerCase(line + start);
+            add(line + start, end - start);
+        }
+        
+        fclose(file);
+        return true;
+    }
+    
+    void compile() {
+        for (int i = 0; i < BLOOM_WORDS; i++) {
+            bloom[i] = 0;
+        }
+        if (word_count == 0) return;
+        
+        for (int i = 0; i < word_count; i++) {
+            bloom[(words[i].hash >> 20) & (BLOOM_WORDS - 1)] |= bloomBits(words[i].hash);
+        }
+        
+        unsigned int table_size = 1;
+        while (table_size < (unsigned int)word_count * 2) table_size *= 2;
+        while (!place(table_size)) table_size *= 2;
+    }
+    
+    bool contains(const char* token, int len) const {
+        unsigned int hash = hashBytes(token, len);
+        unsigned long long bits = bloomBits(hash);
+        if ((bloom[(hash >> 20) & (BLOOM_WORDS - 1)] & bits) != bits) return false;
+        
+        const Entry& entry = slots[slotHash(hash, seeds[hash % bucket_count]) & slot_mask];
+        if (!entry.text || entry.hash != hash || entry.length != len) return false;
+        for (int i = 0; i < len; i++) {
+            if (entry.text[i] != token[i]) return false;
+        }
+        return true;
+    }
+    
+    int getWordCount() const { return word_count; }
+    unsigned int getTableSize() const { return slot_mask + 1; }
+};
+
+JunkFilter junkFilter;
+
+bool isJunkToken(const char* token, int len) {
+    if (junkFilter.contains(token, len)) {
+        return true;
+    }
+    
+    if (token[0] == 'h' && token[1] == 't' && token[2] == 't' && token[3] == 'p')
+        return true;
+    if (token[0] == 'w' && token[1] == 'w' && token[2] == 'w')
+        return true;
+    
+    if (len == 1) {
+        char c = token[0];
+        if (!((c >= 'а' && c <= 'я') || (c >= 'a' && c <= 'z') || 
+              c == 'ё' || c == 'й' || c == '-')) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+const unsigned char BYTE_DELIMITER = 1;
+const unsigned char BYTE_MARKUP = 2;
+
+class ByteScanner {
+private:
+    typedef void (*BlockClassifier)(const char* block, unsigned int& delimiters, unsigned int& markup);
+    
+    unsigned char byte_class[256];
+    BlockClassifier classify;
+    const char* backend;
+    
+    static void classifyScalar(const char* block, unsigned int& delimiters, unsigned int& markup);
+    static void classifySSE(const char* block, unsigned int& delimiters, unsigned int& markup);
+    static void classifyAVX2(const char* block, unsigned int& delimiters, unsigned int& markup);
+    
+public:
+    ByteScanner() {
+        for (int c = 0; c < 256; c++) {
+            byte_class[c] = 0;
+            if (isDelimiter((char)c)) byte_class[c] |= BYTE_DELIMITER;
+            if (c == '&' || c == '<' || c == ']') byte_class[c] |= BYTE_MARKUP;
+        }
+        
+        classify = classifyScalar;
+        backend = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            classify = classifyAVX2;
+            backend = "AVX2";
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            classify = classifySSE;
+            backend = "SSE4.2";
+        }
+#endif
+    }
+    
+    const char* getBackend() const { return backend; }
+    
+    unsigned char classOf(char c) const {
+        return byte_class[(unsigned char)c];
+    }
+    
+    const char* skipDelimiters(const char* ptr, const char* end) const {
+        while (end - ptr >= 32) {
+            unsigned int delimiters, markup;
+            classify(ptr, delimiters, markup);
+            unsigned int stop = ~delimiters | markup;
+            if (stop) return ptr + __builtin_ctz(stop);
+            ptr += 32;
+        }
+        while (ptr < end && byte_class[(unsigned char)*ptr] == BYTE_DELIMITER) ptr++;
+        return ptr;
+    }
+    
+    const char* findTokenEnd(const char* ptr, const char* end) const {
+        while (end - ptr >= 32) {
+            unsigned int delimiters, markup;
+            classify(ptr, delimiters, markup);
+            unsigned int stop = delimiters | markup;
+            if (stop) return ptr + __builtin_ctz(stop);
+            ptr += 32;
+        }
+        while (ptr < end && byte_class[(unsigned char)*ptr] == 0) ptr++;
+        return ptr;
+    }
+};
+
+const ByteScanner byteScanner;
+
+void ByteScanner::classifyScalar(const char* block, unsigned int& delimiters, unsigned int& markup) {
+    delimiters = 0;
+    markup = 0;
+    for (int i = 0; i < 32; i++) {
+        unsigned char cls = byteScanner.classOf(block[i]);
+        delimiters |= (unsigned int)(cls & BYTE_DELIMITER) << i;
+        markup |= (unsigned int)((cls & BYTE_MARKUP) >> 1) << i;
+    }
+}
+
+/*
+Классификация байтов по полубайтам (pshufb): для каждого байта таблица по
+младшему полубайту даёт набор «групп», таблица по старшему — группу этого
+старшего полубайта. Байт принадлежит множеству, если наборы пересекаются.
+Биты 0-3: разделители со старшим полубайтом 0x0, 0x2, 0x3, 0x5.
+Биты 4-6: разметка ('&', '<', ']') со старшим полубайтом 0x2, 0x3, 0x5.
+*/
+static const unsigned char NIBBLE_LO[16] = {
+    0x02, 0x02, 0x02, 0x00, 0x00, 0x00, 0x10, 0x02,
+    0x02, 0x03, 0x05, 0x0C, 0x2A, 0x4B, 0x02, 0x0E
+};
+static const unsigned char NIBBLE_HI[16] = {
+    0x01, 0x00, 0x12, 0x24, 0x00, 0x48, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+void ByteScanner::classifySSE(const char* block, unsigned int& delimiters, unsigned int& markup) {
+    const __m128i lo_table = _mm_loadu_si128((const __m128i*)NIBBLE_LO);
+    const __m128i hi_table = _mm_loadu_si128((const __m128i*)NIBBLE_HI);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i delimiter_bits = _mm_set1_epi8(0x0F);
+    const __m128i markup_bits = _mm_set1_epi8(0x70);
+    const __m128i zero = _mm_setzero_si128();
+    
+    delimiters = 0;
+    markup = 0;
+    for (int half = 0; half < 2; half++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(block + half * 16));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(bytes, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+        __m128i groups = _mm_and_si128(lo, hi);
+        
+        unsigned int d = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(groups, delimiter_bits), zero)) & 0xFFFF;
+        unsigned int m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(groups, markup_bits), zero)) & 0xFFFF;
+        delimiters |= d << (half * 16);
+        markup |= m << (half * 16);
+    }
+}
+
+__attribute__((target("avx2")))
+void ByteScanner::classifyAVX2(const char* block, unsigned int& delimiters, unsigned int& markup) {
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)NIBBLE_LO));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)NIBBLE_HI));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i delimiter_bits = _mm256_set1_epi8(0x0F);
+    const __m256i markup_bits = _mm256_set1_epi8(0x70);
+    const __m256i zero = _mm256_setzero_si256();
+    
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)block);
+    __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(bytes, nibble));
+    __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    __m256i groups = _mm256_and_si256(lo, hi);
+    
+    delimiters = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(groups, delimiter_bits), zero));
+    markup = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(groups, markup_bits), zero));
+}
+#else
+void ByteScanner::classifySSE(const char* block, unsigned int& delimiters, unsigned int& markup) {
+    classifyScalar(block, delimiters, markup);
+}
+
+void ByteScanner::classifyAVX2(const char* block, unsigned int& delimiters, unsigned int& markup) {
+    classifyScalar(block, delimiters, markup);
+}
+#endif
+
+class ContentTokenizer {
+private:
+    const char* ptr;
+    const char* end;
+    
+    bool startsWith(const char* prefix, int n) const {
+        return end - ptr >= n && myStrncmp(ptr, prefix, n) == 0;
+    }
+    
+    void skipMarkup() {
+        if (startsWith("&lt;![CDATA[", 12)) { ptr += 12; return; }
+        if (startsWith("]]&gt;", 6)) { ptr += 6; return; }
+        if (startsWith("<![CDATA[", 9)) { ptr += 9; return; }
+        if (startsWith("]]>", 3)) { ptr += 3; return; }
+        if (startsWith("&quot;", 6)) { ptr += 6; return; }
+        if (startsWith("&amp;", 5)) { ptr += 5; return; }
+        if (startsWith("&lt;", 4)) { ptr += 4; return; }
+        if (startsWith("&gt;", 4)) { ptr += 4; return; }
+        
+        ptr++;
+    }
+    
+public:
+    ContentTokenizer(const char* begin, const char* finish) : ptr(begin), end(finish) {}
+    
+    bool next(const char*& token_start, int& token_len) {
+        while (true) {
+            ptr = byteScanner.skipDelimiters(ptr, end);
+            if (ptr >= end) return false;
+            
+            if (byteScanner.classOf(*ptr) & BYTE_MARKUP) {
+                skipMarkup();
+                continue;
+            }
+            
+            token_start = ptr;
+            ptr = byteScanner.findTokenEnd(ptr, end);
+            token_len = ptr - token_start;
+            return true;
+        }
+    }
+};
+
+/*
+Логарифмы для регрессии по всем рангам. Аргумент раскладывается на мантиссу
+из [sqrt(2)/2, sqrt(2)] и степень двойки, логарифм мантиссы считается тем же
+рядом, что и в myLog, по четыре числа за раз на AVX2 - результаты совпадают
+со скалярной версией бит в бит.
+*/
+
+class LogKernel {
+private:
+    typedef int (*BlockLog)(const double* in, double* out, int n);
+    
+    BlockLog log_blocks;
+    const char* backend;
+    
+    static int logBlocksAVX2(const double* in, double* out, int n);
+    
+public:
+    LogKernel() {
+        log_blocks = nullptr;
+        backend = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            log_blocks = logBlocksAVX2;
+            backend = "AVX2";
+        }
+#endif
+    }
+    
+    const char* getBackend() const { return backend; }
+    
+    void logArray(const double* in, double* out, int n) const {
+        int i = log_blocks ? log_blocks(in, out, n) : 0;
+        for (; i < n; i++) {
+            out[i] = myLog(in[i]);
+        }
+    }
+};
+
+const LogKernel logKernel;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int LogKernel::logBlocksAVX2(const double* in, double* out, int n) {
+    const __m256i mantissa_mask = _mm256_set1_epi64x(0xFFFFFFFFFFFFFLL);
+    const __m256i one_bits = _mm256_set1_epi64x(0x3FF0000000000000LL);
+    const __m256i shift_bits = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256d shift_bias = _mm256_set1_pd(4503599627370496.0 + 1023);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(in + i);
+        __m256i bits = _mm256_castpd_si256(x);
+        
+        __m256d exponent = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), shift_bits));
+        exponent = _mm256_sub_pd(exponent, shift_bias);
+        __m256d mantissa = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), one_bits));
+        __m256d large = _mm256_cmp_pd(mantissa, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+        mantissa = _mm256_blendv_pd(mantissa, _mm256_mul_pd(mantissa, _mm256_set1_pd(0.5)), large);
+        exponent = _mm256_add_pd(exponent, _mm256_and_pd(large, one));
+        
+        __m256d term = _mm256_div_pd(_mm256_sub_pd(mantissa, one), _mm256_add_pd(mantissa, one));
+        __m256d term_sq = _mm256_mul_pd(term, term);
+        __m256d series = _mm256_set1_pd(1.0 / (2 * LOG_SERIES_TERMS - 1));
+        for (int k = LOG_SERIES_TERMS - 2; k >= 0; k--) {
+            series = _mm256_add_pd(_mm256_mul_pd(series, term_sq), _mm256_set1_pd(1.0 / (2 * k + 1)));
+        }
+        
+        __m256d result = _mm256_add_pd(_mm256_mul_pd(exponent, _mm256_set1_pd(LN2)),
+                                       _mm256_mul_pd(_mm256_mul_pd(two, term), series));
+        __m256d positive = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ);
+        _mm256_storeu_pd(out + i, _mm256_and_pd(result, positive));
+    }
+    return i;
+}
+#endif
+
+/*
+Степенные законы проверяются прямой в логарифмических координатах:
+log y = intercept + slope * log x методом наименьших квадратов. Для Ципфа
+x - ранг, y - частота (показатель s = -slope), для Хипса x - число
+токенов, y - размер словаря (показатель beta = slope).
+*/
+
+struct LinearFit {
+    double slope;
+    double intercept;
+    double r_squared;
+    int points;
+};
+
+LinearFit fitLine(const double* x, const double* y, int n) {
+    LinearFit fit = {0, 0, 0, n};
+    if (n < 2) return fit;
+    
+    double mean_x = 0;
+    double mean_y = 0;
+    for (int i = 0; i < n; i++) {
+        mean_x += x[i];
+        mean_y += y[i];
+    }
+    mean_x /= n;
+    mean_y /= n;
+    
+    double sxx = 0;
+    double sxy = 0;
+    double syy = 0;
+    for (int i = 0; i < n; i++) {
+        double dx = x[i] - mean_x;
+        double dy = y[i] - mean_y;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        syy += dy * dy;
+    }
+    
+    if (sxx > 0) fit.slope = sxy / sxx;
+    fit.intercept = mean_y - fit.slope * mean_x;
+    fit.r_squared = (sxx > 0 && syy > 0) ? (sxy * sxy) / (sxx * syy) : 1;
+    return fit;
+}
+
+LinearFit fitPowerLaw(const double* x, const double* y, int n, double* log_x, double* log_y) {
+    logKernel.logArray(x, log_x, n);
+    logKernel.logArray(y, log_y, n);
+    return fitLine(log_x, log_y, n);
+}
+
+double calculateZipfConstant(long long total_tokens, int unique_tokens) {
+    double harmonic = 0;
+    for (int i = 1; i <= unique_tokens; i++) {
+        harmonic += 1.0 / i;
+    }
+    return total_tokens / harmonic;
+}
+
+void analyzeZipfLaw(FreqPair* freq_array, int unique_tokens, long long total_tokens, const char* title) {
+    std::cout << "\n=== " << title << " ===" << std::endl;
+    
+    double C = calculateZipfConstant(total_tokens, unique_tokens);
+    std::cout << "Константа Ципфа C = " << (int)C << std::endl;
+    
+    std::cout << "\nСРАВНЕНИЕ РЕАЛЬНЫХ И ПРЕДСКАЗАННЫХ ЧАСТОТ:" << std::endl;
+    std::cout << "Ранг\tТокен\t\t\tРеальная\tЦипф\tОтклонение\tlog(Ранг)\tlog(Частота)" << std::endl;
+    std::cout << "---------------------------------------------------------------------------------" << std::endl;
+    
+    double total_deviation = 0;
+    int compare_count = (unique_tokens < 50) ? unique_tokens : 50;
+    
+    for (int i = 0; i < compare_count; i++) {
+        int rank = i + 1;
+        int real_freq = freq_array[i].freq;
+        double zipf_freq = C / rank;
+        double deviation = (real_freq - zipf_freq) / zipf_freq * 100;
+        total_deviation += fabs(deviation);
+        
+        double log_rank = myLog((double)rank);
+        double log_freq = myLog((double)real_freq);
+        
+        std::cout << rank << "\t" << freq_array[i].text;
+        
+        int token_len = myStrlen(freq_array[i].text);
+        if (token_len < 8) std::cout << "\t\t\t";
+        else if (token_len < 16) std::cout << "\t\t";
+        else std::cout << "\t";
+        
+        std::cout << real_freq << "\t" << (int)zipf_freq << "\t" 
+                  << deviation << "%\t" << log_rank << "\t" << log_freq << std::endl;
+    }
+    
+    std::cout << "\nСредняя абсолютная ошибка: " 
+              << total_deviation / compare_count << "%" << std::endl;
+}
+
+void printTopTokens(FreqPair* freq_array, int unique_tokens, long long total_tokens, const char* title) {
+    std::cout << "\n=== " << title << " ===" << std::endl;
+    std::cout << "Ранг\tТокен\t\t\tЧастота\t%" << std::endl;
+    std::cout << "--------------------------------------------------------" << std::endl;
+    
+    int show_count = (unique_tokens < 30) ? unique_tokens : 30;
+    for (int i = 0; i < show_count; i++) {
+        double percentage = (double)freq_array[i].freq / total_tokens * 100;
+        
+        std::cout << (i+1) << "\t" << freq_array[i].text;
+        
+        int token_len = myStrlen(freq_array[i].text);
+        if (token_len < 8) std::cout << "\t\t\t";
+        else if (token_len < 16) std::cout << "\t\t";
+        else std::cout << "\t";
+        
+        std::cout << freq_array[i].freq << "\t" << percentage << "%" << std::endl;
+    }
+}
+
+void demonstrateStemming() {
+    std::cout << "\n=== ПРИМЕРЫ РАБОТЫ СТЕММЕРА ===" << std::endl;
+    
+    RussianStemmer stemmer;
+    
+    const char* examples[] = {
+        "гонщики", "гонщиков", "гонщикам",
+        "команда", "команды", "командами",
+        "чемпионат", "чемпионата", "чемпионате",
+        "побед", "победа", "победы", "победами",
+        "этап", "этапа", "этапов", "этапами",
+        "машина", "машины", "машинами",
+        "трасса", "трассы", "трассе",
+        "racing", "races", "raced",
+        "driver", "drivers", "driving"
+    };
+    
+    int numExamples = sizeof(examples) / sizeof(examples[0]);
+    
+    std::cout << "\nСлово\t\t→\tОснова" << std::endl;
+    std::cout << "-----\t\t \t------" << std::endl;
+    
+    for (int i = 0; i < numExamples; i++) {
+        const char* stemmed = stemmer.stem(examples[i]);
+        std::cout << examples[i] << "\t\t→\t" << stemmed << std::endl;
+    }
+}
+
+
+class OutputBuffer {
+private:
+    char* data;
+    long long capacity;
+    long long size;
+    
+    void reserve(long long needed) {
+        if (size + needed <= capacity) return;
+        while (size + needed > capacity) capacity *= 2;
+        char* new_data = new char[capacity];
+        for (long long i = 0; i < size; i++) {
+            new_data[i] = data[i];
+        }
+        delete[] data;
+        data = new_data;
+    }
+    
+public:
+    OutputBuffer() : capacity(1 << 16), size(0) {
+        data = new char[capacity];
+    }
+    
+    ~OutputBuffer() {
+        delete[] data;
+    }
+    
+    void append(const char* str, long long len) {
+        reserve(len);
+        for (long long i = 0; i < len; i++) {
+            data[size++] = str[i];
+        }
+    }
+    
+    void appendChar(char c) {
+        reserve(1);
+        data[size++] = c;
+    }
+    
+    void appendString(const char* str) {
+        append(str, myStrlen(str));
+    }
+    
+    void appendInt(int value) {
+        char digits[12];
+        int n = 0;
+        do {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        reserve(n);
+        while (n > 0) {
+            data[size++] = digits[--n];
+        }
+    }
+    
+    void writeTo(FILE* file) const {
+        fwrite(data, 1, size, file);
+    }
+    
+    void clear() {
+        size = 0;
+    }
+    
+    const char* getData() const { return data; }
+    long long getSize() const { return size; }
+};
+
+const long long CHUNK_CONTENT_BYTES = 4 * 1024 * 1024;
+
+struct ArticleChunk {
+    int first;
+    int last;
+};
+
+int splitIntoChunks(const CorpusView& corpus, ArticleChunk*& chunks) {
+    int capacity = 16;
+    int count = 0;
+    chunks = new ArticleChunk[capacity];
+    
+    int first = 0;
+    long long chunk_bytes = 0;
+    for (int d = 0; d < corpus.getCount(); d++) {
+        const ArticleSpan& article = corpus.get(d);
+        chunk_bytes += article.content_end - article.content_begin;
+        
+        if (chunk_bytes >= CHUNK_CONTENT_BYTES || d == corpus.getCount() - 1) {
+            if (count >= capacity) {
+                capacity *= 2;
+                ArticleChunk* new_chunks = new ArticleChunk[capacity];
+                for (int i = 0; i < count; i++) {
+                    new_chunks[i] = chunks[i];
+                }
+                delete[] chunks;
+                chunks = new_chunks;
+            }
+            chunks[count].first = first;
+            chunks[count].last = d + 1;
+            count++;
+            
+            first = d + 1;
+            chunk_bytes = 0;
+        }
+    }
+    
+    return count;
+}
+
+class TokenBatch {
+private:
+    struct DocEntry {
+        int doc_id;
+        int token_count;
+    };
+    
+    DocEntry* docs;
+    int doc_capacity;
+    int doc_count;
+    OutputBuffer tokens;
+    
+    void putInt(int value) {
+        for (int i = 0; i < 4; i++) {
+            tokens.appendChar((char)((value >> (i * 8)) & 0xFF));
+        }
+    }
+    
+public:
+    TokenBatch() : doc_capacity(64), doc_count(0) {
+        docs = new DocEntry[doc_capacity];
+    }
+    
+    ~TokenBatch() {
+        delete[] docs;
+    }
+    
+    void beginDocument(int doc_id) {
+        if (doc_count >= doc_capacity) {
+            doc_capacity *= 2;
+            DocEntry* new_docs = new DocEntry[doc_capacity];
+            for (int i = 0; i < doc_count; i++) {
+                new_docs[i] = docs[i];
+            }
+            delete[] docs;
+            docs = new_docs;
+        }
+        docs[doc_count].doc_id = doc_id;
+        docs[doc_count].token_count = 0;
+        doc_count++;
+    }
+    
+    void addToken(const char* surface, int surface_len, const char* stem, int stem_len, int position, int offset) {
+        tokens.appendChar((char)surface_len);
+        tokens.append(surface, surface_len + 1);
+        tokens.appendChar((char)stem_len);
+        tokens.append(stem, stem_len + 1);
+        putInt(position);
+        putInt(offset);
+        docs[doc_count - 1].token_count++;
+    }
+    
+    static int getInt(const char* ptr) {
+        const unsigned char* p = (const unsigned char*)ptr;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
+    
+    int getDocCount() const { return doc_count; }
+    int getDocId(int index) const { return docs[index].doc_id; }
+    int getTokenCount(int index) const { return docs[index].token_count; }
+    const char* getTokenData() const { return tokens.getData(); }
+};
+
+class TokenSink {
+public:
+    virtual ~TokenSink() {}
+    virtual void beginDocument(int) {}
+    virtual void addToken(int doc_id, const char* surface, int surface_len, const char* stem, int stem_len, int term_id,
+                          int position, int offset) = 0;
+    virtual void endDocument(int) {}
+    virtual void finish() {}
+};
+
+class FrequencySink : public TokenSink {
+private:
+    HashMap& hashmap;
+    
+public:
+    FrequencySink(HashMap& map) : hashmap(map) {}
+    
+    void addToken(int, const char* surface, int surface_len, const char*, int, int, int, int) override {
+        hashmap.addToken(surface, surface_len);
+    }
+};
+
+class TokenWriterSink : public TokenSink {
+private:
+    FILE* file;
+    const char* filename;
+    OutputBuffer buffer;
+    int documents_written;
+    
+    void flush() {
+        buffer.writeTo(file);
+        buffer.clear();
+    }
+    
+public:
+    TokenWriterSink(const char* outputFile) : filename(outputFile), documents_written(0) {
+        file = fopen(outputFile, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла " << outputFile << std::endl;
+            return;
+        }
+        
+        unsigned char bom[] = {0xEF, 0xBB, 0xBF};
+        fwrite(bom, 1, 3, file);
+        
+        fprintf(file, "doc_id,token\n");
+    }
+    
+    ~TokenWriterSink() {
+        if (file) fclose(file);
+    }
+    
+    bool isOpen() const { return file != nullptr; }
+    
+    void addToken(int doc_id, const char*, int, const char* stem, int stem_len, int, int, int) override {
+        buffer.appendInt(doc_id);
+        buffer.appendChar(',');
+        buffer.append(stem, stem_len);
+        buffer.appendChar('\n');
+    }
+    
+    void endDocument(int) override {
+        documents_written++;
+        if (buffer.getSize() >= (1 << 20)) flush();
+    }
+    
+    void finish() override {
+        flush();
+        fclose(file);
+        file = nullptr;
+        std::cout << "Токены из " << documents_written << " документов сохранены в " << filename << std::endl;
+    }
+};
+
+/*
+Поиск почти-дубликатов по MinHash: документ - множество шинглов из трёх
+подряд идущих основ. Подпись строится одним хешем на шингл (one permutation
+hashing): старшие биты выбирают одну из MINHASH_SIZE корзин, младшие идут в
+её минимум; пустые корзины заимствуют значение следующей непустой. LSH делит подпись на MINHASH_BANDS полос по MINHASH_ROWS
+значений; документы с совпавшей полосой сравниваются по доле совпавших
+минимумов (оценка меры Жаккара). Канонической считается первая статья
+кластера, в таблицу LSH попадают только канонические.
+
+Подписи канонических статей сохраняются рядом с манифестом. При запуске
+с --incremental подпись неизменённой канонической ставится в таблицу LSH
+на своём месте в корпусе - перед следующей токенизируемой статьёй, - и
+сама проверяется по уже стоящим там, как при полном проходе.
+
+ФОРМАТ TOKENS.MINHASH: "TKMH", VERSION (uint32), MINHASH_SIZE (uint32),
+COUNT (uint32), затем COUNT записей: DOC_ID (uint32), MINHASH_SIZE
+значений подписи (uint32).
+*/
+
+const int MINHASH_BITS = 6;
+const int MINHASH_SIZE = 1 << MINHASH_BITS;
+const int MINHASH_BANDS = 16;
+const int MINHASH_ROWS = MINHASH_SIZE / MINHASH_BANDS;
+const int SHINGLE_SIZE = 3;
+const double DUPLICATE_JACCARD = 0.8;
+const unsigned int SIGNATURE_FILE_VERSION = 1;
+
+class DuplicateSink : public TokenSink {
+private:
+    struct BandEntry {
+        unsigned long long key;
+        int doc;
+        int next;
+    };
+    
+    unsigned long long seeds[MINHASH_BANDS];
+    unsigned int signature[MINHASH_SIZE];
+    unsigned long long window[SHINGLE_SIZE];
+    int window_fill;
+    int shingles;
+    
+    unsigned int* signatures;
+    int* canonical_ids;
+    int* cluster_sizes;
+    int canonical_count;
+    int canonical_capacity;
+    
+    BandEntry* entries;
+    int entry_count;
+    int entry_capacity;
+    int* heads;
+    int head_mask;
+    
+    int* duplicate_pairs;
+    int duplicate_count;
+    int duplicate_capacity;
+    int cluster_count;
+    int current_canonical;
+    
+    unsigned int* stored_signatures;
+    int* stored_slots;
+    int stored_size;
+    int* pending_ids;
+    int* pending_next;
+    int pending_count;
+    int pending_pos;
+    
+    static unsigned int readUInt32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
+    
+    static void putUInt32(unsigned char* p, unsigned int value) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (unsigned char)((value >> (i * 8)) & 0xFF);
+        }
+    }
+    
+    static unsigned long long mix(unsigned long long x) {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+    
+    void addShingle(unsigned long long shingle) {
+        int bin = (int)(shingle >> (64 - MINHASH_BITS));
+        unsigned int value = (unsigned int)shingle;
+        if (value < signature[bin]) signature[bin] = value;
+        shingles++;
+    }
+    
+    void densify() {
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            if (signature[i] != 0xFFFFFFFFu) continue;
+            for (int step = 1; step < MINHASH_SIZE; step++) {
+                unsigned int borrowed = signature[(i + step) % MINHASH_SIZE];
+                if (borrowed != 0xFFFFFFFFu) {
+                    signature[i] = (unsigned int)mix(((unsigned long long)step << 32) | borrowed);
+                    break;
+                }
+            }
+        }
+    }
+    
+    unsigned long long bandKey(const unsigned int* sig, int band) const {
+        unsigned long long key = seeds[band];
+        for (int r = 0; r < MINHASH_ROWS; r++) {
+            key = mix(key ^ sig[band * MINHASH_ROWS + r]);
+        }
+        return key;
+    }
+    
+    int similarity(const unsigned int* a, const unsigned int* b) const {
+        int same = 0;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            same += (a[i] == b[i]);
+        }
+        return same;
+    }
+    
+    void growHeads() {
+        int size = (head_mask + 1) * 2;
+        delete[] heads;
+        heads = new int[size];
+        for (int i = 0; i < size; i++) {
+            heads[i] = -1;
+        }
+        head_mask = size - 1;
+        for (int e = 0; e < entry_count; e++) {
+            int slot = (int)(entries[e].key & head_mask);
+            entries[e].next = heads[slot];
+            heads[slot] = e;
+        }
+    }
+    
+    void addBandEntry(unsigned long long key, int doc) {
+        if (entry_count >= entry_capacity) {
+            entry_capacity *= 2;
+            BandEntry* new_entries = new BandEntry[entry_capacity];
+            for (int i = 0; i < entry_count; i++) {
+                new_entries[i] = entries[i];
+            }
+            delete[] entries;
+            entries = new_entries;
+        }
+        entries[entry_count].key = key;
+        entries[entry_count].doc = doc;
+        int slot = (int)(key & head_mask);
+        entries[entry_count].next = heads[slot];
+        heads[slot] = entry_count;
+        entry_count++;
+        if (entry_count > head_mask) growHeads();
+    }
+    
+    int findCanonical() const {
+        int threshold = (int)(DUPLICATE_JACCARD * MINHASH_SIZE + 0.999);
+        for (int band = 0; band < MINHASH_BANDS; band++) {
+            unsigned long long key = bandKey(signature, band);
+            for (int e = heads[key & head_mask]; e >= 0; e = entries[e].next) {
+                if (entries[e].key != key) continue;
+                int doc = entries[e].doc;
+                if (similarity(signature, signatures + (long long)doc * MINHASH_SIZE) >= threshold) {
+                    return doc;
+                }
+            }
+        }
+        return -1;
+    }
+    
+    void addCanonical(int doc_id) {
+        if (canonical_count >= canonical_capacity) {
+            canonical_capacity *= 2;
+            unsigned int* new_signatures = new unsigned int[(long long)canonical_capacity * MINHASH_SIZE];
+            int* new_ids = new int[canonical_capacity];
+            int* new_sizes = new int[canonical_capacity];
+            for (long long i = 0; i < (long long)canonical_count * MINHASH_SIZE; i++) {
+                new_signatures[i] = signatures[i];
+            }
+            for (int i = 0; i < canonical_count; i++) {
+                new_ids[i] = canonical_ids[i];
+                new_sizes[i] = cluster_sizes[i];
+            }
+            delete[] signatures;
+            delete[] canonical_ids;
+            delete[] cluster_sizes;
+            signatures = new_signatures;
+            canonical_ids = new_ids;
+            cluster_sizes = new_sizes;
+        }
+        
+        int doc = canonical_count++;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            signatures[(long long)doc * MINHASH_SIZE + i] = signature[i];
+        }
+        canonical_ids[doc] = doc_id;
+        cluster_sizes[doc] = 0;
+        for (int band = 0; band < MINHASH_BANDS; band++) {
+            addBandEntry(bandKey(signature, band), doc);
+        }
+    }
+    
+    void addDuplicate(int doc_id, int canonical_id) {
+        if (duplicate_count >= duplicate_capacity) {
+            duplicate_capacity *= 2;
+            int* new_pairs = new int[duplicate_capacity * 2];
+            for (int i = 0; i < duplicate_count * 2; i++) {
+                new_pairs[i] = duplicate_pairs[i];
+            }
+            delete[] duplicate_pairs;
+            duplicate_pairs = new_pairs;
+        }
+        duplicate_pairs[duplicate_count * 2] = doc_id;
+        duplicate_pairs[duplicate_count * 2 + 1] = canonical_id;
+        duplicate_count++;
+    }
+    
+    void classify(int doc_id) {
+        int doc = findCanonical();
+        if (doc >= 0) {
+            current_canonical = canonical_ids[doc];
+            if (cluster_sizes[doc]++ == 0) cluster_count++;
+            addDuplicate(doc_id, current_canonical);
+        } else {
+            addCanonical(doc_id);
+        }
+    }
+    
+    // Подпись неизменённой канонической из прошлого запуска
+    void reuseCanonical(int doc_id) {
+        if (doc_id < 0 || doc_id >= stored_size || stored_slots[doc_id] < 0) return;
+        const unsigned int* stored = stored_signatures + (long long)stored_slots[doc_id] * MINHASH_SIZE;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            signature[i] = stored[i];
+        }
+        classify(doc_id);
+    }
+    
+    void flushReused() {
+        while (pending_pos < pending_count) {
+            reuseCanonical(pending_ids[pending_pos++]);
+        }
+    }
+    
+public:
+    DuplicateSink() : window_fill(0), shingles(0), canonical_count(0), canonical_capacity(1024),
+                      entry_count(0), entry_capacity(1024), head_mask(1023),
+                      duplicate_count(0), duplicate_capacity(64), cluster_count(0),
+                      current_canonical(-1), stored_signatures(nullptr), stored_slots(nullptr), stored_size(0),
+                      pending_ids(nullptr), pending_next(nullptr), pending_count(0), pending_pos(0) {
+        unsigned long long state = 0x9E3779B97F4A7C15ULL;
+        for (int i = 0; i < MINHASH_BANDS; i++) {
+            state += 0x9E3779B97F4A7C15ULL;
+            seeds[i] = mix(state);
+        }
+        signatures = new unsigned int[(long long)canonical_capacity * MINHASH_SIZE];
+        canonical_ids = new int[canonical_capacity];
+        cluster_sizes = new int[canonical_capacity];
+        entries = new BandEntry[entry_capacity];
+        heads = new int[head_mask + 1];
+        for (int i = 0; i <= head_mask; i++) {
+            heads[i] = -1;
+        }
+        duplicate_pairs = new int[duplicate_capacity * 2];
+    }
+    
+    ~DuplicateSink() {
+        delete[] signatures;
+        delete[] canonical_ids;
+        delete[] cluster_sizes;
+        delete[] entries;
+        delete[] heads;
+        delete[] duplicate_pairs;
+        delete[] stored_signatures;
+        delete[] stored_slots;
+        delete[] pending_ids;
+        delete[] pending_next;
+    }
+    
+    bool loadSignatures(const char* filename) {
+        if (access(filename, F_OK) != 0) return false;
+        
+        MappedFile file;
+        if (!file.open(filename)) return false;
+        
+        const unsigned char* data = (const unsigned char*)file.getData();
+        if (file.getSize() < 16 || data[0] != 'T' || data[1] != 'K' || data[2] != 'M' || data[3] != 'H' ||
+            readUInt32(data + 4) != SIGNATURE_FILE_VERSION || readUInt32(data + 8) != MINHASH_SIZE) {
+            std::cerr << "Неверный формат файла подписей: " << filename << std::endl;
+            return false;
+        }
+        
+        unsigned int stored = readUInt32(data + 12);
+        long long record = 4 + MINHASH_SIZE * 4;
+        if ((unsigned long long)file.getSize() < 16 + (unsigned long long)stored * record) {
+            std::cerr << "Файл подписей обрезан: " << filename << std::endl;
+            return false;
+        }
+        
+        int max_doc_id = -1;
+        for (unsigned int i = 0; i < stored; i++) {
+            int doc_id = (int)readUInt32(data + 16 + i * record);
+            if (doc_id > max_doc_id) max_doc_id = doc_id;
+        }
+        stored_size = max_doc_id + 1;
+        stored_slots = new int[stored_size > 0 ? stored_size : 1];
+        for (int i = 0; i < stored_size; i++) {
+            stored_slots[i] = -1;
+        }
+        stored_signatures = new unsigned int[stored > 0 ? (long long)stored * MINHASH_SIZE : 1];
+        for (unsigned int i = 0; i < stored; i++) {
+            const unsigned char* p = data + 16 + i * record;
+            stored_slots[readUInt32(p)] = (int)i;
+            for (int j = 0; j < MINHASH_SIZE; j++) {
+                stored_signatures[(long long)i * MINHASH_SIZE + j] = readUInt32(p + 4 + j * 4);
+            }
+        }
+        return true;
+    }
+    
+    bool saveSignatures(const char* filename) const {
+        char temp_name[512];
+        int len = myStrlen(filename);
+        if (len > 500) len = 500;
+        for (int i = 0; i < len; i++) {
+            temp_name[i] = filename[i];
+        }
+        myStrcpy(temp_name + len, ".tmp");
+        
+        FILE* file = fopen(temp_name, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла " << temp_name << std::endl;
+            return false;
+        }
+        
+        unsigned char record[4 + MINHASH_SIZE * 4];
+        fwrite("TKMH", 1, 4, file);
+        putUInt32(record, SIGNATURE_FILE_VERSION);
+        putUInt32(record + 4, MINHASH_SIZE);
+        putUInt32(record + 8, canonical_count);
+        fwrite(record, 1, 12, file);
+        for (int doc = 0; doc < canonical_count; doc++) {
+            putUInt32(record, canonical_ids[doc]);
+            for (int i = 0; i < MINHASH_SIZE; i++) {
+                putUInt32(record + 4 + i * 4, signatures[(long long)doc * MINHASH_SIZE + i]);
+            }
+            fwrite(record, 1, sizeof(record), file);
+        }
+        
+        bool ok = fflush(file) == 0;
+        fclose(file);
+        if (!ok || rename(temp_name, filename) != 0) {
+            std::cerr << "Ошибка записи подписей " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Неизменённые статьи окна; next - doc_id следующей токенизируемой статьи или -1
+    void setReused(const int* ids, const int* next, int count) {
+        flushReused();
+        delete[] pending_ids;
+        delete[] pending_next;
+        pending_ids = new int[count > 0 ? count : 1];
+        pending_next = new int[count > 0 ? count : 1];
+        for (int i = 0; i < count; i++) {
+            pending_ids[i] = ids[i];
+            pending_next[i] = next[i];
+        }
+        pending_count = count;
+        pending_pos = 0;
+    }
+    
+    void beginDocument(int doc_id) override {
+        while (pending_pos < pending_count && pending_next[pending_pos] == doc_id) {
+            reuseCanonical(pending_ids[pending_pos++]);
+        }
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            signature[i] = 0xFFFFFFFFu;
+        }
+        window_fill = 0;
+        shingles = 0;
+        current_canonical = -1;
+    }
+    
+    void addToken(int, const char*, int, const char* stem, int stem_len, int, int, int) override {
+        for (int i = 0; i + 1 < SHINGLE_SIZE; i++) {
+            window[i] = window[i + 1];
+        }
+        window[SHINGLE_SIZE - 1] = hashBytes64(stem, stem_len);
+        if (window_fill < SHINGLE_SIZE) window_fill++;
+        
+        if (window_fill == SHINGLE_SIZE) {
+            unsigned long long shingle = 0;
+            for (int i = 0; i < SHINGLE_SIZE; i++) {
+                shingle = mix(shingle ^ window[i]);
+            }
+            addShingle(shingle);
+        }
+    }
+    
+    void endDocument(int doc_id) override {
+        if (shingles == 0) {
+            if (window_fill == 0) return;
+            unsigned long long shingle = 0;
+            for (int i = SHINGLE_SIZE - window_fill; i < SHINGLE_SIZE; i++) {
+                shingle = mix(shingle ^ window[i]);
+            }
+            addShingle(shingle);
+        }
+        densify();
+        classify(doc_id);
+    }
+    
+    void finish() override {
+        flushReused();
+    }
+    
+    int getCurrentCanonical() const { return current_canonical; }
+    int getDuplicateCount() const { return duplicate_count; }
+    const int* getDuplicatePairs() const { return duplicate_pairs; }
+    int getClusterCount() const { return cluster_count; }
+};
+
+/*
+ФОРМАТ ФАЙЛА TOKENS.BIN (все числа little-endian):
+
+ЗАГОЛОВОК:
+[0-3]   MAGIC: "TKNS" (4 байта)
+[4-7]   VERSION: 5 (uint32)
+[8-11]  DOC_COUNT: количество документов (uint32)
+[12-19] TOKEN_COUNT: общее количество токенов (uint64)
+[20-23] TERM_COUNT: количество термов в словаре (uint32)
+[24-31] DICTIONARY_OFFSET: смещение до словаря термов (uint64)
+[32-35] FLAGS: бит 0 - дельта, в потоке только новые и изменённые документы,
+        бит 1 - почти-дубликаты выброшены из потока (uint32)
+[36-39] DELETED_COUNT: количество удалённых doc_id (uint32)
+[40-47] DELETED_OFFSET: смещение до списка удалённых doc_id (uint64)
+[48-51] DUPLICATE_COUNT: количество найденных почти-дубликатов (uint32)
+[52-59] DUPLICATE_OFFSET: смещение до пар дубликатов (uint64)
+
+БЛОК ДОКУМЕНТА (повторяется DOC_COUNT раз, в порядке документов в корпусе;
+doc_id не обязаны возрастать):
+[0-3]   DOC_ID (uint32)
+[4-7]   TOKEN_COUNT: количество токенов в документе (uint32)
+[8...]  TOKENS: TOKEN_COUNT записей, каждая из трёх чисел VByte:
+        TERM_ID - идентификатор терма,
+        POSITION_DELTA - приращение порядкового номера слова в документе,
+        OFFSET_DELTA - приращение байтового смещения токена от начала
+                       текста <content> в articles.xml
+        (для первого токена документа - сами номер и смещение)
+
+СЛОВАРЬ (начинается с DICTIONARY_OFFSET, термы в порядке TERM_ID = 0, 1, ...):
+  [0]     LENGTH: длина основы в байтах (uint8)
+  [1-N]   TERM: байты основы (UTF-8, без завершающего нуля)
+
+УДАЛЁННЫЕ ДОКУМЕНТЫ (с DELETED_OFFSET): DELETED_COUNT значений DOC_ID (uint32)
+по возрастанию. Документ из дельты заменяет прежнюю версию целиком; дельту
+tokens_delta.bin токенизатор сразу применяет к tokens.bin (TokenDeltaMerger).
+
+ПОЧТИ-ДУБЛИКАТЫ (с DUPLICATE_OFFSET): DUPLICATE_COUNT пар DOC_ID (uint32),
+CANONICAL_DOC_ID (uint32) в порядке обработки документов.
+
+Идентификаторы термов плотные и назначаются в порядке первого появления
+основы в корпусе, поэтому частые термы получают короткие VByte-коды.
+Порядковые номера считают все слова текста, включая отброшенные фильтром,
+поэтому пропуски в номерах отмечают удалённые стоп-слова.
+*/
+
+const unsigned int TOKEN_STREAM_VERSION = 5;
+const unsigned int TOKEN_STREAM_HEADER_SIZE = 60;
+const unsigned int TOKEN_STREAM_DELTA = 1;
+const unsigned int TOKEN_STREAM_DUPLICATES_DROPPED = 2;
+
+class TokenStreamWriterSink : public TokenSink {
+private:
+    FILE* file;
+    const char* filename;
+    const HashMap& dictionary;
+    OutputBuffer buffer;
+    OutputBuffer document;
+    int doc_tokens;
+    int last_position;
+    int last_offset;
+    unsigned int doc_count;
+    unsigned long long token_count;
+    unsigned long long bytes_written;
+    unsigned long long dictionary_offset;
+    unsigned int flags;
+    const int* deleted_ids;
+    int deleted_count;
+    unsigned long long deleted_offset;
+    const DuplicateSink* duplicates;
+    unsigned long long duplicate_offset;
+    unsigned int dropped_docs;
+    bool quiet;
+    
+    friend class TokenDeltaMerger;
+    
+    static void putUInt32(OutputBuffer& out, unsigned int value) {
+        for (int i = 0; i < 4; i++) {
+            out.appendChar((char)((value >> (i * 8)) & 0xFF));
+        }
+    }
+    
+    static void putUInt64(OutputBuffer& out, unsigned long long value) {
+        for (int i = 0; i < 8; i++) {
+            out.appendChar((char)((value >> (i * 8)) & 0xFF));
+        }
+    }
+    
+    static void putVByte(OutputBuffer& out, unsigned int value) {
+        while (value >= 0x80) {
+            out.appendChar((char)((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.appendChar((char)value);
+    }
+    
+    void flush() {
+        buffer.writeTo(file);
+        bytes_written += buffer.getSize();
+        buffer.clear();
+    }
+    
+    void writeHeader() {
+        OutputBuffer header;
+        header.append("TKNS", 4);
+        putUInt32(header, TOKEN_STREAM_VERSION);
+        putUInt32(header, doc_count);
+        putUInt64(header, token_count);
+        putUInt32(header, dictionary.getUniqueCount());
+        putUInt64(header, dictionary_offset);
+        putUInt32(header, flags);
+        putUInt32(header, deleted_count);
+        putUInt64(header, deleted_offset);
+        putUInt32(header, duplicates ? duplicates->getDuplicateCount() : 0);
+        putUInt64(header, duplicate_offset);
+        header.writeTo(file);
+    }
+    
+public:
+    TokenStreamWriterSink(const char* outputFile, const HashMap& terms, bool delta = false)
+        : filename(outputFile), dictionary(terms), doc_tokens(0), last_position(0), last_offset(0), doc_count(0),
+          token_count(0), bytes_written(TOKEN_STREAM_HEADER_SIZE), dictionary_offset(0),
+          flags(delta ? TOKEN_STREAM_DELTA : 0), deleted_ids(nullptr), deleted_count(0), deleted_offset(0),
+          duplicates(nullptr), duplicate_offset(0), dropped_docs(0), quiet(false) {
+        file = fopen(outputFile, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла " << outputFile << std::endl;
+            return;
+        }
+        writeHeader();
+    }
+    
+    ~TokenStreamWriterSink() {
+        if (file) fclose(file);
+    }
+    
+    bool isOpen() const { return file != nullptr; }
+    
+    void setDeleted(const int* ids, int count) {
+        deleted_ids = ids;
+        deleted_count = count;
+    }
+    
+    void setQuiet(bool silent) { quiet = silent; }
+    
+    void setDuplicates(const DuplicateSink* detector, bool drop) {
+        duplicates = detector;
+        if (drop) flags |= TOKEN_STREAM_DUPLICATES_DROPPED;
+    }
+    
+    void beginDocument(int) override {
+        document.clear();
+        doc_tokens = 0;
+        last_position = 0;
+        last_offset = 0;
+    }
+    
+    void addToken(int, const char*, int, const char*, int, int term_id, int position, int offset) override {
+        putVByte(document, term_id);
+        putVByte(document, position - last_position);
+        putVByte(document, offset - last_offset);
+        last_position = position;
+        last_offset = offset;
+        doc_tokens++;
+    }
+    
+    void endDocument(int doc_id) override {
+        if ((flags & TOKEN_STREAM_DUPLICATES_DROPPED) && duplicates->getCurrentCanonical() >= 0) {
+            dropped_docs++;
+            return;
+        }
+        
+        putUInt32(buffer, doc_id);
+        putUInt32(buffer, doc_tokens);
+        buffer.append(document.getData(), document.getSize());
+        
+        doc_count++;
+        token_count += doc_tokens;
+        
+        if (buffer.getSize() >= (1 << 20)) {
+            flush();
+        }
+    }
+    
+    void finish() override {
+        flush();
+        dictionary_offset = bytes_written;
+        
+        for (int id = 0; id < dictionary.getUniqueCount(); id++) {
+            const TokenFreq* term = dictionary.getById(id);
+            buffer.appendChar((char)term->length);
+            buffer.append(term->text, term->length);
+            if (buffer.getSize() >= (1 << 20)) {
+                flush();
+            }
+        }
+        flush();
+        
+        deleted_offset = bytes_written;
+        for (int i = 0; i < deleted_count; i++) {
+            putUInt32(buffer, deleted_ids[i]);
+        }
+        flush();
+        
+        duplicate_offset = bytes_written;
+        if (duplicates) {
+            const int* pairs = duplicates->getDuplicatePairs();
+            for (int i = 0; i < duplicates->getDuplicateCount() * 2; i++) {
+                putUInt32(buffer, pairs[i]);
+            }
+        }
+        flush();
+        
+        fseek(file, 0, SEEK_SET);
+        writeHeader();
+        fclose(file);
+        file = nullptr;
+        if (quiet) return;
+        
+        std::cout << "Токены из " << doc_count << " документов сохранены в " << filename
+                  << " (" << token_count << " токенов, " << dictionary.getUniqueCount() << " термов";
+        if (flags & TOKEN_STREAM_DELTA) {
+            std::cout << ", удалённых документов: " << deleted_count;
+        }
+        if (dropped_docs > 0) {
+            std::cout << ", выброшено дубликатов: " << dropped_docs;
+        }
+        std::cout << ")" << std::endl;
+    }
+};
+
+/*
+Применение дельты к tokens.bin (режим --incremental). Словарь полного
+потока сохраняет свои TERM_ID, новые основы из дельты дописываются в
+конец, поэтому блоки неизменённых документов копируются байт в байт, а в
+блоках дельты перекодируются только TERM_ID. Документ из дельты встаёт
+перед первым блоком полного потока с doc_id не меньше своего, прежняя
+версия и удалённые документы выпадают вместе со своими парами дубликатов
+(дубликаты изменённых канонических уже заново проверены в дельте). Результат пишется во временный
+файл и переименовывается поверх tokens.bin; манифест сохраняется только
+после этого, так что неприменённая дельта не теряется.
+*/
+
+struct TokenStreamFile {
+    MappedFile file;
+    const unsigned char* data;
+    long long size;
+    unsigned int flags;
+    unsigned int doc_count;
+    unsigned int term_count;
+    unsigned long long dictionary_offset;
+    unsigned int deleted_count;
+    unsigned long long deleted_offset;
+    unsigned int duplicate_count;
+    unsigned long long duplicate_offset;
+    
+    static unsigned int readUInt32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
+    
+    static unsigned long long readUInt64(const unsigned char* p) {
+        return readUInt32(p) | ((unsigned long long)readUInt32(p + 4) << 32);
+    }
+    
+    static bool readVByte(const unsigned char*& p, const unsigned char* end, unsigned int& value) {
+        value = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            unsigned char byte = *p++;
+            value |= (unsigned int)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+    
+    bool open(const char* filename) {
+        if (access(filename, F_OK) != 0 || !file.open(filename)) return false;
+        data = (const unsigned char*)file.getData();
+        size = file.getSize();
+        if (size < TOKEN_STREAM_HEADER_SIZE || data[0] != 'T' || data[1] != 'K' || data[2] != 'N' ||
+            data[3] != 'S' || readUInt32(data + 4) != TOKEN_STREAM_VERSION) {
+            return false;
+        }
+        
+        doc_count = readUInt32(data + 8);
+        term_count = readUInt32(data + 20);
+        dictionary_offset = readUInt64(data + 24);
+        flags = readUInt32(data + 32);
+        deleted_count = readUInt32(data + 36);
+        deleted_offset = readUInt64(data + 40);
+        duplicate_count = readUInt32(data + 48);
+        duplicate_offset = readUInt64(data + 52);
+        return dictionary_offset <= deleted_offset && deleted_offset + deleted_count * 4ULL <= (unsigned long long)size &&
+               duplicate_offset + duplicate_count * 8ULL <= (unsigned long long)size;
+    }
+    
+    int* readDuplicates() const {
+        int* pairs = new int[duplicate_count > 0 ? duplicate_count * 2 : 1];
+        const unsigned char* p = data + duplicate_offset;
+        for (unsigned int i = 0; i < duplicate_count * 2; i++) {
+            pairs[i] = (int)readUInt32(p + i * 4);
+        }
+        return pairs;
+    }
+    
+    // Возвращает конец блока документа или nullptr, если блок обрезан
+    const unsigned char* skipDocument(const unsigned char* p, int& doc_id, unsigned int& tokens) const {
+        const unsigned char* end = data + dictionary_offset;
+        if (end - p < 8) return nullptr;
+        doc_id = (int)readUInt32(p);
+        tokens = readUInt32(p + 4);
+        p += 8;
+        for (unsigned long long i = 0; i < tokens * 3ULL; i++) {
+            unsigned int value;
+            if (!readVByte(p, end, value)) return nullptr;
+        }
+        return p;
+    }
+};
+
+class TokenDeltaMerger {
+private:
+    TokenStreamFile base;
+    TokenStreamFile delta;
+    HashMap terms;
+    int* term_map;
+    const unsigned char** delta_docs;
+    int* delta_ids;
+    bool* removed;
+    int removed_size;
+    OutputBuffer buffer;
+    FILE* file;
+    unsigned long long bytes_written;
+    unsigned int doc_count;
+    unsigned long long token_count;
+    
+    void flush() {
+        buffer.writeTo(file);
+        bytes_written += buffer.getSize();
+        buffer.clear();
+    }
+    
+    bool isRemoved(int doc_id) const {
+        return doc_id >= 0 && doc_id < removed_size && removed[doc_id];
+    }
+    
+    void markRemoved(int doc_id) {
+        if (doc_id >= 0 && doc_id < removed_size) removed[doc_id] = true;
+    }
+    
+    bool loadDictionary(const TokenStreamFile& stream, int* ids) {
+        const unsigned char* p = stream.data + stream.dictionary_offset;
+        const unsigned char* end = stream.data + stream.deleted_offset;
+        for (unsigned int i = 0; i < stream.term_count; i++) {
+            if (p >= end || end - p - 1 < *p) return false;
+            ids[i] = terms.addToken((const char*)p + 1, *p);
+            p += 1 + *p;
+        }
+        return true;
+    }
+    
+    bool copyDeltaDocument(int index) {
+        const unsigned char* p = delta_docs[index];
+        const unsigned char* end = delta.data + delta.dictionary_offset;
+        unsigned int tokens = TokenStreamFile::readUInt32(p + 4);
+        TokenStreamWriterSink::putUInt32(buffer, delta_ids[index]);
+        TokenStreamWriterSink::putUInt32(buffer, tokens);
+        p += 8;
+        for (unsigned int i = 0; i < tokens; i++) {
+            unsigned int term_id, position_delta, offset_delta;
+            if (!TokenStreamFile::readVByte(p, end, term_id) || term_id >= delta.term_count ||
+                !TokenStreamFile::readVByte(p, end, position_delta) ||
+                !TokenStreamFile::readVByte(p, end, offset_delta)) {
+                return false;
+            }
+            TokenStreamWriterSink::putVByte(buffer, term_map[term_id]);
+            TokenStreamWriterSink::putVByte(buffer, position_delta);
+            TokenStreamWriterSink::putVByte(buffer, offset_delta);
+        }
+        doc_count++;
+        token_count += tokens;
+        return true;
+    }
+    
+    bool writeMerged(const char* filename) {
+        file = fopen(filename, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла " << filename << std::endl;
+            return false;
+        }
+        
+        char header[TOKEN_STREAM_HEADER_SIZE] = {0};
+        fwrite(header, 1, TOKEN_STREAM_HEADER_SIZE, file);
+        bytes_written = TOKEN_STREAM_HEADER_SIZE;
+        
+        int next = 0;
+        const unsigned char* p = base.data + TOKEN_STREAM_HEADER_SIZE;
+        for (unsigned int i = 0; i < base.doc_count; i++) {
+            int doc_id;
+            unsigned int tokens;
+            const unsigned char* block_end = base.skipDocument(p, doc_id, tokens);
+            if (!block_end) return false;
+            
+            while (next < (int)delta.doc_count && delta_ids[next] <= doc_id) {
+                if (!copyDeltaDocument(next++)) return false;
+            }
+            if (!isRemoved(doc_id)) {
+                buffer.append((const char*)p, block_end - p);
+                doc_count++;
+                token_count += tokens;
+            }
+            p = block_end;
+            if (buffer.getSize() >= (1 << 20)) flush();
+        }
+        while (next < (int)delta.doc_count) {
+            if (!copyDeltaDocument(next++)) return false;
+        }
+        flush();
+        
+        unsigned long long dictionary_offset = bytes_written;
+        for (int id = 0; id < terms.getUniqueCount(); id++) {
+            const TokenFreq* term = terms.getById(id);
+            buffer.appendChar((char)term->length);
+            buffer.append(term->text, term->length);
+        }
+        flush();
+        
+        unsigned long long duplicate_offset = bytes_written;
+        unsigned int duplicate_count = 0;
+        const TokenStreamFile* sources[2] = {&base, &delta};
+        for (int s = 0; s < 2; s++) {
+            const unsigned char* pair = sources[s]->data + sources[s]->duplicate_offset;
+            for (unsigned int i = 0; i < sources[s]->duplicate_count; i++, pair += 8) {
+                int doc_id = (int)TokenStreamFile::readUInt32(pair);
+                int canonical = (int)TokenStreamFile::readUInt32(pair + 4);
+                if (s == 0 && isRemoved(doc_id)) continue;
+                TokenStreamWriterSink::putUInt32(buffer, doc_id);
+                TokenStreamWriterSink::putUInt32(buffer, canonical);
+                duplicate_count++;
+            }
+        }
+        flush();
+        
+        buffer.append("TKNS", 4);
+        TokenStreamWriterSink::putUInt32(buffer, TOKEN_STREAM_VERSION);
+        TokenStreamWriterSink::putUInt32(buffer, doc_count);
+        TokenStreamWriterSink::putUInt64(buffer, token_count);
+        TokenStreamWriterSink::putUInt32(buffer, terms.getUniqueCount());
+        TokenStreamWriterSink::putUInt64(buffer, dictionary_offset);
+        TokenStreamWriterSink::putUInt32(buffer, (base.flags | delta.flags) & ~TOKEN_STREAM_DELTA);
+        TokenStreamWriterSink::putUInt32(buffer, 0);
+        TokenStreamWriterSink::putUInt64(buffer, duplicate_offset);
+        TokenStreamWriterSink::putUInt32(buffer, duplicate_count);
+        TokenStreamWriterSink::putUInt64(buffer, duplicate_offset);
+        fseek(file, 0, SEEK_SET);
+        buffer.writeTo(file);
+        buffer.clear();
+        
+        bool ok = fflush(file) == 0;
+        fclose(file);
+        file = nullptr;
+        return ok;
+    }
+    
+public:
+    TokenDeltaMerger() : term_map(nullptr), delta_docs(nullptr), delta_ids(nullptr), removed(nullptr),
+                         removed_size(0), file(nullptr), bytes_written(0), doc_count(0), token_count(0) {}
+    
+    ~TokenDeltaMerger() {
+        if (file) fclose(file);
+        delete[] term_map;
+        delete[] delta_docs;
+        delete[] delta_ids;
+        delete[] removed;
+    }
+    
+    bool apply(const char* base_file, const char* delta_file) {
+        if (!base.open(base_file) || (base.flags & TOKEN_STREAM_DELTA)) {
+            std::cerr << "Ошибка: " << base_file << " не является полным потоком токенов" << std::endl;
+            return false;
+        }
+        if (!delta.open(delta_file) || !(delta.flags & TOKEN_STREAM_DELTA)) {
+            std::cerr << "Ошибка: " << delta_file << " не является дельтой потока токенов" << std::endl;
+            return false;
+        }
+        
+        int* base_ids = new int[base.term_count > 0 ? base.term_count : 1];
+        bool dictionary_ok = loadDictionary(base, base_ids);
+        for (unsigned int i = 0; dictionary_ok && i < base.term_count; i++) {
+            dictionary_ok = base_ids[i] == (int)i;
+        }
+        delete[] base_ids;
+        term_map = new int[delta.term_count > 0 ? delta.term_count : 1];
+        if (!dictionary_ok || !loadDictionary(delta, term_map)) {
+            std::cerr << "Ошибка: повреждён словарь в " << base_file << " или " << delta_file << std::endl;
+            return false;
+        }
+        
+        delta_docs = new const unsigned char*[delta.doc_count > 0 ? delta.doc_count : 1];
+        delta_ids = new int[delta.doc_count > 0 ? delta.doc_count : 1];
+        int max_doc_id = 0;
+        const unsigned char* p = delta.data + TOKEN_STREAM_HEADER_SIZE;
+        for (unsigned int i = 0; i < delta.doc_count; i++) {
+            unsigned int tokens;
+            delta_docs[i] = p;
+            p = delta.skipDocument(p, delta_ids[i], tokens);
+            if (!p) {
+                std::cerr << "Ошибка: обрезан блок документа в " << delta_file << std::endl;
+                return false;
+            }
+            if (delta_ids[i] > max_doc_id) max_doc_id = delta_ids[i];
+        }
+        const unsigned char* deleted = delta.data + delta.deleted_offset;
+        for (unsigned int i = 0; i < delta.deleted_count; i++) {
+            int doc_id = (int)TokenStreamFile::readUInt32(deleted + i * 4);
+            if (doc_id > max_doc_id) max_doc_id = doc_id;
+        }
+        const unsigned char* pairs = delta.data + delta.duplicate_offset;
+        for (unsigned int i = 0; i < delta.duplicate_count; i++) {
+            int doc_id = (int)TokenStreamFile::readUInt32(pairs + i * 8);
+            if (doc_id > max_doc_id) max_doc_id = doc_id;
+        }
+        
+        // Выпадают: изменённые, удалённые и выброшенные как дубликаты в дельте
+        removed_size = max_doc_id + 1;
+        removed = new bool[removed_size];
+        for (int i = 0; i < removed_size; i++) removed[i] = false;
+        for (unsigned int i = 0; i < delta.doc_count; i++) markRemoved(delta_ids[i]);
+        for (unsigned int i = 0; i < delta.deleted_count; i++) {
+            markRemoved((int)TokenStreamFile::readUInt32(deleted + i * 4));
+        }
+        if (delta.flags & TOKEN_STREAM_DUPLICATES_DROPPED) {
+            for (unsigned int i = 0; i < delta.duplicate_count; i++) {
+                markRemoved((int)TokenStreamFile::readUInt32(pairs + i * 8));
+            }
+        }
+        
+        char temp_name[512];
+        int len = myStrlen(base_file);
+        if (len > 500) len = 500;
+        for (int i = 0; i < len; i++) {
+            temp_name[i] = base_file[i];
+        }
+        myStrcpy(temp_name + len, ".tmp");
+        
+        if (!writeMerged(temp_name)) {
+            if (file) {
+                fclose(file);
+                file = nullptr;
+            }
+            std::cerr << "Ошибка записи " << temp_name << std::endl;
+            remove(temp_name);
+            return false;
+        }
+        base.file.close();
+        if (rename(temp_name, base_file) != 0) {
+            std::cerr << "Ошибка замены " << base_file << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    unsigned int getDocCount() const { return doc_count; }
+    unsigned long long getTokenCount() const { return token_count; }
+    int getTermCount() const { return terms.getUniqueCount(); }
+};
+
+class ApproxFrequencySink : public TokenSink {
+private:
+    FrequencySketch& surfaces;
+    FrequencySketch& stems;
+    
+public:
+    ApproxFrequencySink(FrequencySketch& surface_sketch, FrequencySketch& stem_sketch)
+        : surfaces(surface_sketch), stems(stem_sketch) {}
+    
+    void addToken(int, const char* surface, int surface_len, const char* stem, int stem_len, int, int, int) override {
+        surfaces.add(surface, surface_len);
+        stems.add(stem, stem_len);
+    }
+};
+
+class StatisticsSink : public TokenSink {
+private:
+    int documents;
+    long long tokens;
+    long long surface_bytes;
+    long long stem_bytes;
+    int current_doc_tokens;
+    int max_doc_tokens;
+    int max_doc_id;
+    long long stem_cache_lookups;
+    long long stem_cache_hits;
+    
+public:
+    StatisticsSink() : documents(0), tokens(0), surface_bytes(0), stem_bytes(0),
+                       current_doc_tokens(0), max_doc_tokens(0), max_doc_id(-1),
+                       stem_cache_lookups(0), stem_cache_hits(0) {}
+    
+    void addStemCacheStats(long long lookups, long long hits) {
+        stem_cache_lookups += lookups;
+        stem_cache_hits += hits;
+    }
+    
+    void beginDocument(int) override {
+        current_doc_tokens = 0;
+    }
+    
+    void addToken(int, const char*, int surface_len, const char*, int stem_len, int, int, int) override {
+        tokens++;
+        surface_bytes += surface_len;
+        stem_bytes += stem_len;
+        current_doc_tokens++;
+    }
+    
+    void endDocument(int doc_id) override {
+        documents++;
+        if (current_doc_tokens > max_doc_tokens) {
+            max_doc_tokens = current_doc_tokens;
+            max_doc_id = doc_id;
+        }
+        if (documents % 1000 == 0) {
+            std::cout << "Обработано документов: " << documents << std::endl;
+        }
+    }
+    
+    void print(double seconds, long long input_bytes) const {
+        std::cout << "Документов: " << documents << std::endl;
+        std::cout << "Токенов: " << tokens << std::endl;
+        if (tokens > 0) {
+            std::cout << "Средняя длина токена: " << (double)surface_bytes / tokens << " байт" << std::endl;
+            std::cout << "Средняя длина основы: " << (double)stem_bytes / tokens << " байт" << std::endl;
+        }
+        if (documents > 0) {
+            std::cout << "Токенов на документ: " << (double)tokens / documents
+                      << " (максимум " << max_doc_tokens << " в doc " << max_doc_id << ")" << std::endl;
+        }
+        if (stem_cache_lookups > 0) {
+            std::cout << "Кэш стемминга: " << stem_cache_hits << " попаданий из " << stem_cache_lookups
+                      << " (" << stem_cache_hits * 100.0 / stem_cache_lookups << "%)" << std::endl;
+        }
+        if (seconds > 0) {
+            std::cout << "Скорость: " << (input_bytes / (1024.0 * 1024.0)) / seconds << " МБ/сек, "
+                      << (long long)(tokens / seconds) << " токенов/сек" << std::endl;
+        }
+    }
+};
+
+/*
+Кривая роста словаря для закона Хипса снимается прямо во время прохода:
+точки идут с геометрическим шагом 1/HEAPS_SAMPLE_STEP, чтобы равномерно
+покрыть ось log n. Идентификаторы термов выдаются подряд, поэтому размер
+словаря - это максимальный term_id + 1; в приближённом режиме его заменяет
+оценка HyperLogLog.
+*/
+
+const int HEAPS_SAMPLE_STEP = 32;
+
+class HeapsSink : public TokenSink {
+private:
+    const FrequencySketch* sketch;
+    long long tokens;
+    int vocabulary;
+    long long next_sample;
+    double* sample_tokens;
+    double* sample_vocabulary;
+    int sample_count;
+    int sample_capacity;
+    
+    void addSample() {
+        if (sketch) vocabulary = sketch->getUniqueEstimate();
+        
+        if (sample_count >= sample_capacity) {
+            sample_capacity *= 2;
+            double* new_tokens = new double[sample_capacity];
+            double* new_vocabulary = new double[sample_capacity];
+            for (int i = 0; i < sample_count; i++) {
+                new_tokens[i] = sample_tokens[i];
+                new_vocabulary[i] = sample_vocabulary[i];
+            }
+            delete[] sample_tokens;
+            delete[] sample_vocabulary;
+            sample_tokens = new_tokens;
+            sample_vocabulary = new_vocabulary;
+        }
+        
+        sample_tokens[sample_count] = (double)tokens;
+        sample_vocabulary[sample_count] = (double)vocabulary;
+        sample_count++;
+    }
+    
+public:
+    HeapsSink(const FrequencySketch* vocabulary_sketch)
+        : sketch(vocabulary_sketch), tokens(0), vocabulary(0), next_sample(1),
+          sample_count(0), sample_capacity(1024) {
+        sample_tokens = new double[sample_capacity];
+        sample_vocabulary = new double[sample_capacity];
+    }
+    
+    ~HeapsSink() {
+        delete[] sample_tokens;
+        delete[] sample_vocabulary;
+    }
+    
+    void addToken(int, const char*, int, const char*, int, int term_id, int, int) override {
+        tokens++;
+        if (term_id >= vocabulary) vocabulary = term_id + 1;
+        if (tokens >= next_sample) {
+            addSample();
+            next_sample = tokens + tokens / HEAPS_SAMPLE_STEP + 1;
+        }
+    }
+    
+    void finish() override {
+        if (tokens > 0 && (sample_count == 0 || sample_tokens[sample_count - 1] < tokens)) {
+            addSample();
+        }
+    }
+    
+    const double* getTokens() const { return sample_tokens; }
+    const double* getVocabulary() const { return sample_vocabulary; }
+    int getSampleCount() const { return sample_count; }
+};
+
+void analyzeChunk(const CorpusView& corpus, const ArticleChunk& chunk, RussianStemmer& stemmer, TokenBatch& batch) {
+    for (int d = chunk.first; d < chunk.last; d++) {
+        const ArticleSpan& article = corpus.get(d);
+        ContentTokenizer tokenizer(article.content_begin, article.content_end);
+        batch.beginDocument(article.doc_id);
+        
+        const char* token_start;
+        int token_len;
+        int position = -1;
+        while (tokenizer.next(token_start, token_len)) {
+            position++;
+            if (token_len > 0 && token_len < 50) {
+                char token_text[50];
+                for (int j = 0; j < token_len; j++) {
+                    token_text[j] = token_start[j];
+                }
+                token_text[token_len] = '\0';
+                
+                toLowerCase(token_text, token_len);
+                
+                if (!isJunkToken(token_text, token_len)) {
+                    const char* stem = stemmer.stem(token_text);
+                    batch.addToken(token_text, token_len, stem, myStrlen(stem),
+                                   position, (int)(token_start - article.content_begin));
+                }
+            }
+        }
+    }
+}
+
+void replayBatch(const TokenBatch& batch, HashMap* dictionary, TokenSink** sinks, int sink_count) {
+    const char* ptr = batch.getTokenData();
+    
+    for (int d = 0; d < batch.getDocCount(); d++) {
+        int doc_id = batch.getDocId(d);
+        for (int s = 0; s < sink_count; s++) {
+            sinks[s]->beginDocument(doc_id);
+        }
+        
+        for (int t = 0; t < batch.getTokenCount(d); t++) {
+            int surface_len = (unsigned char)*ptr++;
+            const char* surface = ptr;
+            ptr += surface_len + 1;
+            int stem_len = (unsigned char)*ptr++;
+            const char* stem = ptr;
+            ptr += stem_len + 1;
+            int position = TokenBatch::getInt(ptr);
+            int offset = TokenBatch::getInt(ptr + 4);
+            ptr += 8;
+            
+            int term_id = dictionary ? dictionary->addToken(stem, stem_len) : -1;
+            
+            for (int s = 0; s < sink_count; s++) {
+                sinks[s]->addToken(doc_id, surface, surface_len, stem, stem_len, term_id, position, offset);
+            }
+        }
+        
+        for (int s = 0; s < sink_count; s++) {
+            sinks[s]->endDocument(doc_id);
+        }
+    }
+}
+
+class ChunkPipeline {
+private:
+    const CorpusView& corpus;
+    ArticleChunk* chunks;
+    int chunk_count;
+    int window;
+    
+    TokenBatch** results;
+    bool* done;
+    int next_chunk;
+    int written;
+    long long cache_lookups;
+    long long cache_hits;
+    
+    std::mutex mutex;
+    std::condition_variable chunk_ready;
+    std::condition_variable slot_free;
+    
+    void worker() {
+        RussianStemmer stemmer;
+        
+        while (true) {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                slot_free.wait(lock, [this] { return next_chunk >= chunk_count || next_chunk < written + window; });
+                if (next_chunk >= chunk_count) {
+                    cache_lookups += stemmer.getCacheLookups();
+                    cache_hits += stemmer.getCacheHits();
+                    return;
+                }
+                index = next_chunk++;
+            }
+            
+            TokenBatch* batch = new TokenBatch();
+            analyzeChunk(corpus, chunks[index], stemmer, *batch);
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results[index] = batch;
+                done[index] = true;
+            }
+            chunk_ready.notify_all();
+        }
+    }
+    
+public:
+    ChunkPipeline(const CorpusView& c, ArticleChunk* ch, int count, int num_threads)
+        : corpus(c), chunks(ch), chunk_count(count), window(num_threads * 2),
+          next_chunk(0), written(0), cache_lookups(0), cache_hits(0) {
+        results = new TokenBatch*[chunk_count];
+        done = new bool[chunk_count];
+        for (int i = 0; i < chunk_count; i++) {
+            results[i] = nullptr;
+            done[i] = false;
+        }
+    }
+    
+    ~ChunkPipeline() {
+        for (int i = 0; i < chunk_count; i++) {
+            delete results[i];
+        }
+        delete[] results;
+        delete[] done;
+    }
+    
+    template <typename Consumer>
+    void run(int num_threads, Consumer consume) {
+        std::thread* workers = new std::thread[num_threads];
+        for (int t = 0; t < num_threads; t++) {
+            workers[t] = std::thread(&ChunkPipeline::worker, this);
+        }
+        
+        for (int i = 0; i < chunk_count; i++) {
+            TokenBatch* batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                chunk_ready.wait(lock, [this, i] { return done[i]; });
+                batch = results[i];
+                results[i] = nullptr;
+            }
+            
+            consume(*batch);
+            delete batch;
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                written = i + 1;
+            }
+            slot_free.notify_all();
+        }
+        
+        for (int t = 0; t < num_threads; t++) {
+            workers[t].join();
+        }
+        delete[] workers;
+    }
+    
+    long long getCacheLookups() const { return cache_lookups; }
+    long long getCacheHits() const { return cache_hits; }
+};
+
+void runAnalyzer(const CorpusView& corpus, HashMap* dictionary, TokenSink** sinks, int sink_count, int num_threads,
+                 StatisticsSink& statistics) {
+    ArticleChunk* chunks;
+    int chunk_count = splitIntoChunks(corpus, chunks);
+    
+    auto consume = [&](const TokenBatch& batch) {
+        replayBatch(batch, dictionary, sinks, sink_count);
+    };
+    
+    if (num_threads <= 1) {
+        RussianStemmer stemmer;
+        for (int i = 0; i < chunk_count; i++) {
+            TokenBatch batch;
+            analyzeChunk(corpus, chunks[i], stemmer, batch);
+            consume(batch);
+        }
+        statistics.addStemCacheStats(stemmer.getCacheLookups(), stemmer.getCacheHits());
+    } else {
+        std::cout << "Параллельный анализ: " << num_threads << " потоков, "
+                  << chunk_count << " блоков статей" << std::endl;
+        ChunkPipeline pipeline(corpus, chunks, chunk_count, num_threads);
+        pipeline.run(num_threads, consume);
+        statistics.addStemCacheStats(pipeline.getCacheLookups(), pipeline.getCacheHits());
+    }
+    
+    delete[] chunks;
+}
+
+void finishSinks(TokenSink** sinks, int sink_count) {
+    for (int s = 0; s < sink_count; s++) {
+        sinks[s]->finish();
+    }
+}
+
+bool writeRanking(const char* filename, const FreqPair* array, int size) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        std::cerr << "Ошибка создания файла " << filename << std::endl;
+        return false;
+    }
+    
+    OutputBuffer buffer;
+    buffer.append("rank,token,frequency\n", 21);
+    for (int i = 0; i < size; i++) {
+        buffer.appendInt(i + 1);
+        buffer.appendChar(',');
+        buffer.append(array[i].text, myStrlen(array[i].text));
+        buffer.appendChar(',');
+        buffer.appendInt(array[i].freq);
+        buffer.appendChar('\n');
+        if (buffer.getSize() >= (1 << 20)) {
+            buffer.writeTo(file);
+            buffer.clear();
+        }
+    }
+    buffer.writeTo(file);
+    fclose(file);
+    return true;
+}
+
+bool writeLawCsv(const char* filename, const char* header, const double* x, const double* y,
+                 const double* log_x, const double* log_y, int n, const LinearFit& fit) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        std::cerr << "Ошибка создания файла " << filename << std::endl;
+        return false;
+    }
+    
+    fprintf(file, "%s\n", header);
+    for (int i = 0; i < n; i++) {
+        double fitted = myExp(fit.intercept + fit.slope * log_x[i]);
+        fprintf(file, "%.0f,%.0f,%.6f,%.6f,%.3f\n", x[i], y[i], log_x[i], log_y[i], fitted);
+    }
+    fclose(file);
+    return true;
+}
+
+bool writeLawsJson(const char* filename, const LinearFit& zipf, bool zipf_exact, const LinearFit& heaps,
+                   long long tokens, int vocabulary) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        std::cerr << "Ошибка создания файла " << filename << std::endl;
+        return false;
+    }
+    
+    fprintf(file, "{\n");
+    fprintf(file, "  \"zipf\": {\"exponent\": %.6f, \"constant\": %.3f, \"r_squared\": %.6f, "
+                  "\"ranks\": %d, \"exact\": %s},\n",
+            -zipf.slope, myExp(zipf.intercept), zipf.r_squared, zipf.points, zipf_exact ? "true" : "false");
+    fprintf(file, "  \"heaps\": {\"k\": %.6f, \"beta\": %.6f, \"r_squared\": %.6f, \"samples\": %d, "
+                  "\"tokens\": %lld, \"vocabulary\": %d},\n",
+            myExp(heaps.intercept), heaps.slope, heaps.r_squared, heaps.points, tokens, vocabulary);
+    fprintf(file, "  \"log_backend\": \"%s\"\n", logKernel.getBackend());
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+void freeFreqArray(FreqPair* array) {
+    delete[] array;
 }
 
-void printTopTokens(FreqPair* freq_array, int unique_tokens, int total_tokens, const char* title) {
-    std::cout << "\n=== " << title << " ===" << std::endl;
-    std::cout << "Ранг\tТокен\t\t\tЧастота\t%" << std::endl;
-    std::cout << "--------------------------------------------------------" << std::endl;
-    
-    int show_count = (unique_tokens < 30) ? unique_tokens : 30;
-    for (int i = 0; i < show_count; i++) {
-        double percentage = (double)freq_array[i].freq / total_tokens * 100;
-        
-        std::cout << (i+1) << "\t" << freq_array[i].text;
-        
-        int token_len = myStrlen(freq_array[i].text);
-        if (token_len < 8) std::cout << "\t\t\t";
-        else if (token_len < 16) std::cout << "\t\t";
-        else std::cout << "\t";
-        
-        std::cout << freq_array[i].freq << "\t" << percentage << "%" << std::endl;
+
+void prepareJunkFilter(const char* stopwords_file) {
+    if (!junkFilter.loadFile(stopwords_file)) {
+        std::cout << "Файл " << stopwords_file << " не найден, используется встроенный список" << std::endl;
+        junkFilter.addDefaults();
     }
+    junkFilter.compile();
 }
 
-void demonstrateStemming() {
-    std::cout << "\n=== ПРИМЕРЫ РАБОТЫ СТЕММЕРА ===" << std::endl;
+/*
+Режим --bench: каждая стадия гоняется отдельно на заранее подготовленном
+входе предыдущей стадии, время - настенное (steady_clock), по прогонам
+печатаются минимум, медиана, p90 и максимум. МБ/сек для извлечения
+считаются по размеру XML, для остальных стадий - по объёму текста статей;
+токенов/сек - по числу токенов, выданных сканером. --bench-synthetic MB
+заменяет articles.xml сгенерированным корпусом с распределением Ципфа.
+*/
+
+const int DEFAULT_BENCH_RUNS = 5;
+const int SYNTHETIC_VOCABULARY = 20000;
+
+class BenchSeries {
+private:
+    double* samples;
+    int count;
+    int capacity;
     
-    RussianStemmer stemmer;
+public:
+    BenchSeries(int runs) : count(0), capacity(runs > 0 ? runs : 1) {
+        samples = new double[capacity];
+    }
     
-    const char* examples[] = {
-        "гонщики", "гонщиков", "гонщикам",
-        "команда", "команды", "командами",
-        "чемпионат", "чемпионата", "чемпионате",
-        "побед", "победа", "победы", "победами",
-        "этап", "этапа", "этапов", "этапами",
-        "машина", "машины", "машинами",
-        "трасса", "трассы", "трассе",
-        "racing", "races", "raced",
-        "driver", "drivers", "driving"
-    };
+    ~BenchSeries() {
+        delete[] samples;
+    }
     
-    int numExamples = sizeof(examples) / sizeof(examples[0]);
+    void add(double seconds) {
+        if (count < capacity) samples[count++] = seconds;
+    }
     
-    std::cout << "\nСлово\t\t→\tОснова" << std::endl;
-    std::cout << "-----\t\t \t------" << std::endl;
+    double percentile(double p) const {
+        double* sorted = new double[count > 0 ? count : 1];
+        for (int i = 0; i < count; i++) {
+            double value = samples[i];
+            int j = i;
+            while (j > 0 && sorted[j - 1] > value) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = value;
+        }
+        int rank = (int)(p * count + 0.999999);
+        if (rank < 1) rank = 1;
+        if (rank > count) rank = count;
+        double result = count > 0 ? sorted[rank - 1] : 0;
+        delete[] sorted;
+        return result;
+    }
     
-    for (int i = 0; i < numExamples; i++) {
-        const char* stemmed = stemmer.stem(examples[i]);
-        std::cout << examples[i] << "\t\t→\t" << stemmed << std::endl;
+    void report(const char* stage, long long bytes, long long tokens) const {
+        double median = percentile(0.5);
+        std::cout << stage;
+        int width = 0;
+        for (const char* c = stage; *c; c++) {
+            width += ((unsigned char)*c & 0xC0) != 0x80;
+        }
+        for (int i = width; i < 24; i++) std::cout << ' ';
+        std::cout << percentile(0.0) * 1000 << "\t" << median * 1000 << "\t" << percentile(0.9) * 1000 << "\t"
+                  << percentile(1.0) * 1000 << "\t";
+        if (median > 0) {
+            std::cout << (bytes / (1024.0 * 1024.0)) / median << "\t" << (long long)(tokens / median);
+        }
+        std::cout << std::endl;
     }
-}
+};
 
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-int extractArticleId(const char* xml, int start_pos, int xml_size) {
-    int pos = start_pos;
-    
+char* generateSyntheticCorpus(long long target_bytes, long long& size) {
+    static const char* const syllables[] = {
+        "ра", "ко", "ма", "ст", "пе", "ли", "то", "ни", "гон", "ка", "тр", "ас", "ве", "ло", "ди",
+        "че", "мп", "ио", "на", "те", "ро", "зи", "ша", "ку", "бо", "ль", "ны", "ей", "ов", "ами"
+    };
+    static const char* const latin[] = {"race", "lap", "pole", "team", "driver", "red", "bull", "www", "news"};
+    const int syllable_count = sizeof(syllables) / sizeof(syllables[0]);
+    const int latin_count = sizeof(latin) / sizeof(latin[0]);
     
-    int search_limit = pos + 100;
-    if (search_limit > xml_size) search_limit = xml_size;
+    char* words = new char[SYNTHETIC_VOCABULARY * 32];
+    unsigned long long state = 0x2545F4914F6CDD1DULL;
+    for (int w = 0; w < SYNTHETIC_VOCABULARY; w++) {
+        char* word = words + w * 32;
+        int len = 0;
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        if (state % 10 == 0) {
+            const char* src = latin[(state >> 8) % latin_count];
+            while (*src) word[len++] = *src++;
+        } else {
+            int parts = 1 + (int)((state >> 8) % 4);
+            for (int s = 0; s < parts; s++) {
+                const char* src = syllables[(state >> (12 + s * 5)) % syllable_count];
+                while (*src) word[len++] = *src++;
+            }
+        }
+        word[len] = '\0';
+    }
     
-    while (pos < search_limit) {
-        if (myStrncmp(xml + pos, "id=\"", 4) == 0) {
-            pos += 4; 
-            
-            
-            int id = 0;
-            while (pos < xml_size && xml[pos] >= '0' && xml[pos] <= '9') {
-                id = id * 10 + (xml[pos] - '0');
-                pos++;
+    OutputBuffer xml;
+    xml.appendString("<?xml version=\"1.0\" ?>\n<articles>\n");
+    int doc_id = 0;
+    while (xml.getSize() < target_bytes) {
+        doc_id++;
+        xml.appendString("  <article id=\"");
+        xml.appendInt(doc_id);
+        xml.appendString("\" source=\"bench\">\n    <url>https://bench.local/");
+        xml.appendInt(doc_id);
+        xml.appendString("</url>\n    <content>&lt;![CDATA[\n");
+        
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        int words_in_doc = 100 + (int)(state % 400);
+        for (int i = 0; i < words_in_doc; i++) {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            double u = (double)(state >> 11) / 9007199254740992.0;
+            int rank = (int)myExp(u * myLog((double)SYNTHETIC_VOCABULARY)) - 1;
+            const char* word = words + rank * 32;
+            int len = myStrlen(word);
+            if ((state & 0xF) == 0 && (unsigned char)word[0] == 0xD0) {
+                char upper[32];
+                myStrcpy(upper, word);
+                unsigned char second = (unsigned char)upper[1];
+                if (second >= 0xB0 && second <= 0xBF) upper[1] = (char)(second - 0x20);
+                xml.append(upper, len);
+            } else {
+                xml.append(word, len);
+            }
+            xml.appendChar(((state >> 4) & 0x1F) == 0 ? ',' : ' ');
+            if (((state >> 9) & 0x3F) == 0) {
+                xml.appendInt((int)(state >> 40) % 100);
+                xml.appendChar(' ');
             }
-            
-            return id;
         }
-        pos++;
+        xml.appendString("\n]]&gt;</content>\n  </article>\n");
     }
+    xml.appendString("</articles>\n");
+    delete[] words;
     
-    return -1; 
+    size = xml.getSize();
+    char* data = new char[size];
+    for (long long i = 0; i < size; i++) {
+        data[i] = xml.getData()[i];
+    }
+    return data;
 }
 
-void saveTokensForIndexing(const char* xml_content, int xml_size, RussianStemmer& stemmer, const char* outputFile) {
-    FILE* file = fopen(outputFile, "wb");
-    if (!file) {
-        std::cerr << "Ошибка создания файла " << outputFile << std::endl;
-        return;
+class BenchTokens {
+private:
+    char* text;
+    char* original;
+    long long text_size;
+    long long text_capacity;
+    long long* offsets;
+    int* docs;
+    long long count;
+    long long capacity;
+    
+public:
+    BenchTokens() : original(nullptr), text_size(0), text_capacity(1 << 20), count(0), capacity(1024) {
+        text = new char[text_capacity];
+        offsets = new long long[capacity + 1];
+        docs = new int[capacity];
+        offsets[0] = 0;
+    }
+    
+    ~BenchTokens() {
+        delete[] text;
+        delete[] original;
+        delete[] offsets;
+        delete[] docs;
+    }
+    
+    void add(const char* token, int len, int doc_id) {
+        if (text_size + len + 1 > text_capacity) {
+            while (text_size + len + 1 > text_capacity) text_capacity *= 2;
+            char* new_text = new char[text_capacity];
+            for (long long i = 0; i < text_size; i++) new_text[i] = text[i];
+            delete[] text;
+            text = new_text;
+        }
+        if (count >= capacity) {
+            capacity *= 2;
+            long long* new_offsets = new long long[capacity + 1];
+            int* new_docs = new int[capacity];
+            for (long long i = 0; i <= count; i++) new_offsets[i] = offsets[i];
+            for (long long i = 0; i < count; i++) new_docs[i] = docs[i];
+            delete[] offsets;
+            delete[] docs;
+            offsets = new_offsets;
+            docs = new_docs;
+        }
+        
+        for (int i = 0; i < len; i++) text[text_size++] = token[i];
+        text[text_size++] = '\0';
+        docs[count++] = doc_id;
+        offsets[count] = text_size;
+    }
+    
+    // Стадии, меняющие текст на месте, перед каждым прогоном получают исходный
+    void snapshot() {
+        delete[] original;
+        original = new char[text_size > 0 ? text_size : 1];
+        for (long long i = 0; i < text_size; i++) original[i] = text[i];
+    }
+    
+    void restore() {
+        for (long long i = 0; i < text_size; i++) text[i] = original[i];
+    }
+    
+    long long getCount() const { return count; }
+    char* get(long long index) { return text + offsets[index]; }
+    int getLength(long long index) const { return (int)(offsets[index + 1] - offsets[index] - 1); }
+    int getDoc(long long index) const { return docs[index]; }
+};
+
+int runBenchmark(const char* xml_path, long long synthetic_bytes, int runs, int num_threads) {
+    MappedFile xml_file;
+    char* synthetic = nullptr;
+    const char* data;
+    long long size;
+    
+    if (synthetic_bytes > 0) {
+        synthetic = generateSyntheticCorpus(synthetic_bytes, size);
+        data = synthetic;
+        std::cout << "Корпус: синтетический, " << size << " байт" << std::endl;
+    } else {
+        if (!xml_file.open(xml_path)) return 1;
+        data = xml_file.getData();
+        size = xml_file.getSize();
+        std::cout << "Корпус: " << xml_path << ", " << size << " байт" << std::endl;
     }
     
-    unsigned char bom[] = {0xEF, 0xBB, 0xBF};
-    fwrite(bom, 1, 3, file);
+    CorpusView corpus;
+    corpus.build(data, size);
+    long long content_bytes = corpus.getContentBytes();
     
-    fprintf(file, "doc_id,token\n");
+    BenchTokens surfaces;
+    BenchTokens stems;
+    for (int d = 0; d < corpus.getCount(); d++) {
+        const ArticleSpan& article = corpus.get(d);
+        ContentTokenizer tokenizer(article.content_begin, article.content_end);
+        const char* start;
+        int len;
+        while (tokenizer.next(start, len)) {
+            if (len > 0 && len < 50) surfaces.add(start, len, article.doc_id);
+        }
+    }
+    long long token_count = surfaces.getCount();
+    surfaces.snapshot();
+    
+    RussianStemmer prepare_stemmer;
+    for (long long t = 0; t < token_count; t++) {
+        char word[50];
+        myStrcpy(word, surfaces.get(t));
+        toLowerCase(word, surfaces.getLength(t));
+        const char* stem = prepare_stemmer.stem(word);
+        stems.add(stem, myStrlen(stem), surfaces.getDoc(t));
+    }
     
-    const char* ptr = xml_content;
-    const char* end = xml_content + xml_size;
-    int documents_processed = 0;
+    std::cout << "Статей: " << corpus.getCount() << ", текста: " << content_bytes << " байт, токенов: "
+              << token_count << std::endl;
+    std::cout << "Прогонов: " << runs << ", потоков в полном проходе: " << num_threads
+              << ", регистр: " << caseFolder.getBackend() << std::endl;
+    std::cout << "\nСтадия                  мин,мс\tмед,мс\tp90,мс\tмакс,мс\tМБ/сек\tтокенов/сек" << std::endl;
+    std::cout << "--------------------------------------------------------------------------------" << std::endl;
     
-    while (ptr < end) {
+    BenchSeries extraction(runs);
+    BenchSeries scanning(runs);
+    BenchSeries folding(runs);
+    BenchSeries filtering(runs);
+    BenchSeries stemming(runs);
+    BenchSeries output(runs);
+    BenchSeries pipeline(runs);
+    long long checksum = 0;
+    
+    for (int run = 0; run < runs; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CorpusView view;
+        view.build(data, size);
+        extraction.add(secondsSince(start));
+        checksum += view.getCount();
         
-        if (myStrncmp(ptr, "<article", 8) == 0) {
-            
-            int doc_id = extractArticleId(xml_content, ptr - xml_content, xml_size);
-            
-            if (doc_id == -1) {
-                ptr++;
-                continue; 
+        start = std::chrono::steady_clock::now();
+        long long scanned = 0;
+        for (int d = 0; d < corpus.getCount(); d++) {
+            ContentTokenizer tokenizer(corpus.get(d).content_begin, corpus.get(d).content_end);
+            const char* token_start;
+            int len;
+            while (tokenizer.next(token_start, len)) scanned += len;
+        }
+        scanning.add(secondsSince(start));
+        checksum += scanned;
+        
+        surfaces.restore();
+        start = std::chrono::steady_clock::now();
+        for (long long t = 0; t < token_count; t++) {
+            toLowerCase(surfaces.get(t), surfaces.getLength(t));
+        }
+        folding.add(secondsSince(start));
+        
+        start = std::chrono::steady_clock::now();
+        long long kept = 0;
+        for (long long t = 0; t < token_count; t++) {
+            kept += !isJunkToken(surfaces.get(t), surfaces.getLength(t));
+        }
+        filtering.add(secondsSince(start));
+        checksum += kept;
+        
+        RussianStemmer* stemmer = new RussianStemmer();
+        start = std::chrono::steady_clock::now();
+        long long stem_bytes = 0;
+        for (long long t = 0; t < token_count; t++) {
+            stem_bytes += myStrlen(stemmer->stem(surfaces.get(t)));
+        }
+        stemming.add(secondsSince(start));
+        checksum += stem_bytes;
+        delete stemmer;
+        
+        HashMap* dictionary = new HashMap();
+        TokenStreamWriterSink* writer = new TokenStreamWriterSink("/dev/null", *dictionary);
+        writer->setQuiet(true);
+        start = std::chrono::steady_clock::now();
+        int current_doc = -1;
+        int position = 0;
+        for (long long t = 0; t < token_count; t++) {
+            if (stems.getDoc(t) != current_doc) {
+                if (current_doc >= 0) writer->endDocument(current_doc);
+                current_doc = stems.getDoc(t);
+                writer->beginDocument(current_doc);
+                position = 0;
             }
-            
-            
-            const char* content_start = ptr;
-            while (content_start < end && myStrncmp(content_start, "<content>", 9) != 0) {
-                content_start++;
-                
-                if (myStrncmp(content_start, "<article", 8) == 0) {
-                    break;
-                }
+            int term_id = dictionary->addToken(stems.get(t), stems.getLength(t));
+            writer->addToken(current_doc, surfaces.get(t), surfaces.getLength(t), stems.get(t), stems.getLength(t),
+                             term_id, position++, 0);
+        }
+        if (current_doc >= 0) writer->endDocument(current_doc);
+        writer->finish();
+        output.add(secondsSince(start));
+        delete writer;
+        delete dictionary;
+        
+        dictionary = new HashMap();
+        writer = new TokenStreamWriterSink("/dev/null", *dictionary);
+        writer->setQuiet(true);
+        StatisticsSink statistics;
+        TokenSink* sinks[1] = {writer};
+        start = std::chrono::steady_clock::now();
+        runAnalyzer(corpus, dictionary, sinks, 1, num_threads, statistics);
+        finishSinks(sinks, 1);
+        pipeline.add(secondsSince(start));
+        checksum += dictionary->getTotalCount();
+        delete writer;
+        delete dictionary;
+    }
+    
+    extraction.report("извлечение XML", size, token_count);
+    scanning.report("поиск разделителей", content_bytes, token_count);
+    folding.report("нижний регистр", content_bytes, token_count);
+    filtering.report("мусорные токены", content_bytes, token_count);
+    stemming.report("стемминг", content_bytes, token_count);
+    output.report("словарь и tokens.bin", content_bytes, token_count);
+    pipeline.report("полный проход", content_bytes, token_count);
+    std::cout << "\nКонтрольная сумма: " << checksum << std::endl;
+    
+    delete[] synthetic;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::cout << "=== ТОКЕНИЗАЦИЯ И СТЕММИНГ ===" << std::endl;
+    
+    int num_threads = 1;
+    bool write_csv = false;
+    long long stream_window = 0;
+    const char* ranking_file = nullptr;
+    bool approximate = false;
+    const char* laws_prefix = nullptr;
+    bool incremental = false;
+    int dedup_mode = 0;
+    int bench_runs = 0;
+    long long synthetic_bytes = 0;
+    const char* stopwords_file = "stopwords.txt";
+    for (int i = 1; i < argc; i++) {
+        if (myStrcmp(argv[i], "--threads") && i + 1 < argc) {
+            num_threads = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                num_threads = num_threads * 10 + (*p - '0');
             }
-            
-            if (content_start >= end || myStrncmp(content_start, "<content>", 9) != 0) {
-                ptr++;
-                continue; 
+            if (num_threads == 0) {
+                num_threads = std::thread::hardware_concurrency();
             }
-            
-            content_start += 9; 
-            
-            
-            const char* content_end = content_start;
-            while (content_end < end && myStrncmp(content_end, "</content>", 10) != 0) {
-                content_end++;
+        } else if (myStrcmp(argv[i], "--csv")) {
+            write_csv = true;
+        } else if (myStrcmp(argv[i], "--stopwords") && i + 1 < argc) {
+            stopwords_file = argv[++i];
+        } else if (myStrcmp(argv[i], "--laws") && i + 1 < argc) {
+            laws_prefix = argv[++i];
+        } else if (myStrcmp(argv[i], "--dedup") && i + 1 < argc &&
+                   (myStrcmp(argv[i + 1], "mark") || myStrcmp(argv[i + 1], "drop"))) {
+            dedup_mode = myStrcmp(argv[++i], "drop") ? 2 : 1;
+        } else if (myStrcmp(argv[i], "--bench") && i + 1 < argc) {
+            bench_runs = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                bench_runs = bench_runs * 10 + (*p - '0');
             }
-            
-            
-            const char* doc_ptr = content_start;
-            
-            while (doc_ptr < content_end) {
-                
-                if (myStrncmp(doc_ptr, "&lt;![CDATA[", 12) == 0) {
-                    doc_ptr += 12;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "]]&gt;", 6) == 0) {
-                    doc_ptr += 6;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "<![CDATA[", 9) == 0) {
-                    doc_ptr += 9;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "]]>", 3) == 0) {
-                    doc_ptr += 3;
-                    continue;
-                }
-                
-                
-                if (myStrncmp(doc_ptr, "&quot;", 6) == 0) {
-                    doc_ptr += 6;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "&amp;", 5) == 0) {
-                    doc_ptr += 5;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "&lt;", 4) == 0) {
-                    doc_ptr += 4;
-                    continue;
-                }
-                if (myStrncmp(doc_ptr, "&gt;", 4) == 0) {
-                    doc_ptr += 4;
-                    continue;
-                }
-                
-                
-                if (isDelimiter(*doc_ptr)) {
-                    doc_ptr++;
-                    continue;
-                }
-                
-                
-                const char* token_start = doc_ptr;
-                
-                while (doc_ptr < content_end && !isDelimiter(*doc_ptr)) {
-                    
-                    if (*doc_ptr == '&' || *doc_ptr == '<' || *doc_ptr == ']') {
-                        break;
-                    }
-                    doc_ptr++;
-                }
-                
-                int token_len = doc_ptr - token_start;
-                if (token_len > 0 && token_len < 50) {
-                    char* token_text = new char[token_len + 1];
-                    for (int j = 0; j < token_len; j++) {
-                        token_text[j] = token_start[j];
-                    }
-                    token_text[token_len] = '\0';
-                    
-                    toLowerCase(token_text);
-                    
-                    if (!isJunkToken(token_text)) {
-                        const char* stem = stemmer.stem(token_text);
-                        fprintf(file, "%d,%s\n", doc_id, stem);
-                    }
-                    
-                    delete[] token_text;
-                }
+            if (bench_runs == 0) bench_runs = DEFAULT_BENCH_RUNS;
+        } else if (myStrcmp(argv[i], "--bench-synthetic") && i + 1 < argc) {
+            synthetic_bytes = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                synthetic_bytes = synthetic_bytes * 10 + (*p - '0');
             }
-            
-            documents_processed++;
-            if (documents_processed % 1000 == 0) {
-                std::cout << "Обработано документов: " << documents_processed << std::endl;
+            synthetic_bytes = (synthetic_bytes > 0 ? synthetic_bytes : 1) * 1024 * 1024;
+        } else if (myStrcmp(argv[i], "--incremental")) {
+            incremental = true;
+        } else if (myStrcmp(argv[i], "--approx")) {
+            approximate = true;
+        } else if (myStrcmp(argv[i], "--ranking") && i + 1 < argc) {
+            ranking_file = argv[++i];
+        } else if (myStrcmp(argv[i], "--stream") && i + 1 < argc) {
+            long long megabytes = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                megabytes = megabytes * 10 + (*p - '0');
             }
-            
-            
-            ptr = content_end + 10; 
+            stream_window = megabytes > 0 ? megabytes * 1024 * 1024 : DEFAULT_STREAM_WINDOW;
         } else {
-            ptr++;
+            std::cout << "Использование: " << argv[0] << " [--threads N] [--csv] [--stopwords FILE] [--stream MB] [--ranking FILE] [--approx] [--laws PREFIX] [--incremental] [--dedup mark|drop] [--bench N] [--bench-synthetic MB]" << std::endl;
+            std::cout << "  --threads N  - параллельный анализ корпуса (0 = по числу ядер)" << std::endl;
+            std::cout << "  --csv        - дополнительно записать tokens.csv" << std::endl;
+            std::cout << "  --stopwords  - файл мусорных токенов (по умолчанию stopwords.txt)" << std::endl;
+            std::cout << "  --stream MB  - потоковое чтение окнами по MB мегабайт (0 = 64)" << std::endl;
+            std::cout << "  --ranking F  - выгрузить полный частотный рейтинг основ в CSV" << std::endl;
+            std::cout << "  --approx     - приближённая статистика в ограниченной памяти (без tokens.bin)" << std::endl;
+            std::cout << "  --laws P     - записать P_zipf.csv, P_heaps.csv и P.json с регрессией Ципфа и Хипса" << std::endl;
+            std::cout << "  --incremental - токенизировать только статьи, изменённые с прошлого запуска, и применить дельту к tokens.bin" << std::endl;
+            std::cout << "  --dedup M    - почти-дубликаты по MinHash: mark - отметить в tokens.bin, drop - выбросить" << std::endl;
+            std::cout << "  --bench N    - замерить стадии токенизатора N прогонами (0 = 5) и выйти" << std::endl;
+            std::cout << "  --bench-synthetic MB - бенчмарк на синтетическом корпусе из MB мегабайт" << std::endl;
+            return 1;
         }
     }
     
-    fclose(file);
-    std::cout << "Токены из " << documents_processed << " документов сохранены в " << outputFile << std::endl;
-}
-void freeFreqArray(FreqPair* array, int size) {
-    for (int i = 0; i < size; i++) {
-        delete[] array[i].text;
+    if (bench_runs > 0 || synthetic_bytes > 0) {
+        std::cout << "\n=== БЕНЧМАРК ТОКЕНИЗАТОРА ===" << std::endl;
+        prepareJunkFilter(stopwords_file);
+        return runBenchmark("../lab2/articles.xml", synthetic_bytes,
+                            bench_runs > 0 ? bench_runs : DEFAULT_BENCH_RUNS, num_threads);
+    }
+    
+    if ((incremental || dedup_mode) && approximate) {
+        std::cerr << "Ошибка: --incremental и --dedup несовместимы с --approx" << std::endl;
+        return 1;
     }
-    delete[] array;
-}
-
-
-int main() {
-    std::cout << "=== ТОКЕНИЗАЦИЯ И СТЕММИНГ ===" << std::endl;
     
     
     demonstrateStemming();
@@ -799,65 +4570,251 @@ int main() {
     
     std::cout << "\n1. ЧТЕНИЕ ФАЙЛА" << std::endl;
     
-    int file_size;
-    char* xml_content = readFile("../lab2/articles.xml", file_size);
-    if (!xml_content) {
-        return 1;
-    }
-    
-    std::cout << "Размер XML файла: " << file_size << " байт" << std::endl;
+    const char* xml_path = "../lab2/articles.xml";
+    MappedFile xml_file;
+    CorpusStream stream;
+    CorpusView corpus;
     
+    if (stream_window > 0) {
+        if (!stream.open(xml_path, stream_window)) {
+            return 1;
+        }
+        std::cout << "Потоковый режим: окно " << stream_window / (1024 * 1024) << " МБ" << std::endl;
+        
+        std::cout << "\n2. ИЗВЛЕЧЕНИЕ ТЕКСТА ИЗ CONTENT" << std::endl;
+        std::cout << "Статьи извлекаются по окнам во время прохода" << std::endl;
+    } else {
+        if (!xml_file.open(xml_path)) {
+            return 1;
+        }
+        
+        std::cout << "Размер XML файла: " << xml_file.getSize() << " байт (mmap)" << std::endl;
+        
+        
+        std::cout << "\n2. ИЗВЛЕЧЕНИЕ ТЕКСТА ИЗ CONTENT" << std::endl;
+        
+        corpus.build(xml_file.getData(), xml_file.getSize());
+        
+        std::cout << "Найдено статей: " << corpus.getCount() << std::endl;
+        std::cout << "Извлечено текста: " << corpus.getContentBytes() << " байт" << std::endl;
+        
+        if (corpus.getCount() == 0) {
+            std::cerr << "Ошибка: не удалось извлечь текст из XML!" << std::endl;
+            return 1;
+        }
+    }
     
-    std::cout << "\n2. ИЗВЛЕЧЕНИЕ ТЕКСТА ИЗ CONTENT" << std::endl;
     
-    int extracted_size;
-    char* text = extractContentFromXML(xml_content, file_size, extracted_size);
+    std::cout << "\n3. ТОКЕНИЗАЦИЯ И СТЕММИНГ (единый проход)" << std::endl;
     
-    delete[] xml_content;
+    prepareJunkFilter(stopwords_file);
+    std::cout << "Мусорных токенов в фильтре: " << junkFilter.getWordCount()
+              << " (таблица " << junkFilter.getTableSize() << " слотов)" << std::endl;
     
-    std::cout << "Извлечено текста: " << extracted_size << " байт" << std::endl;
+    HashMap hashmap_original;
+    HashMap hashmap_stemmed;
+    FrequencySketch sketch_original;
+    FrequencySketch sketch_stemmed;
+    FrequencySink original_sink(hashmap_original);
+    ApproxFrequencySink approx_sink(sketch_original, sketch_stemmed);
+    HeapsSink heaps_sink(approximate ? &sketch_stemmed : nullptr);
+    StatisticsSink statistics;
+    DuplicateSink duplicate_sink;
+    IncrementalTracker tracker;
     
-    if (extracted_size == 0) {
-        std::cerr << "Ошибка: не удалось извлечь текст из XML!" << std::endl;
-        return 1;
+    const char* manifest_file = "tokens.manifest";
+    const char* token_file = "tokens.bin";
+    const char* signature_file = "tokens.minhash";
+    if (incremental) {
+        TokenStreamFile base_stream;
+        bool base_dedup = access(signature_file, F_OK) == 0;
+        if (!base_stream.open(token_file) || (base_stream.flags & TOKEN_STREAM_DELTA)) {
+            std::cout << token_file << " отсутствует или не является полным потоком, выполняется полная токенизация" << std::endl;
+        } else if (base_dedup != (dedup_mode != 0) ||
+                   ((base_stream.flags & TOKEN_STREAM_DUPLICATES_DROPPED) != 0) != (dedup_mode == 2)) {
+            std::cout << "Режим --dedup отличается от прошлого запуска, выполняется полная токенизация" << std::endl;
+        } else if (dedup_mode && !duplicate_sink.loadSignatures(signature_file)) {
+            std::cout << "Подписи " << signature_file << " не загружены, выполняется полная токенизация" << std::endl;
+        } else if (tracker.loadPrevious(manifest_file)) {
+            int* pairs = base_stream.readDuplicates();
+            tracker.setDuplicates(pairs, base_stream.duplicate_count);
+            delete[] pairs;
+            token_file = "tokens_delta.bin";
+            std::cout << "Инкрементальный режим: манифест " << manifest_file << " загружен" << std::endl;
+        } else {
+            std::cout << "Манифест " << manifest_file << " не найден, выполняется полная токенизация" << std::endl;
+        }
     }
     
+    TokenSink* sinks[7];
+    int sink_count = 0;
+    HashMap* dictionary = nullptr;
     
-    std::cout << "\n3. ТОКЕНИЗАЦИЯ БЕЗ СТЕММИНГА" << std::endl;
-    
-    clock_t start_original = clock();
-    
-    HashMap hashmap_original;
-    tokenizeText(text, hashmap_original);
+    TokenStreamWriterSink* token_stream = nullptr;
+    if (approximate) {
+        std::cout << "Приближённый режим: Count-Min + Space-Saving + HyperLogLog, tokens.bin не пишется" << std::endl;
+        sinks[sink_count++] = &approx_sink;
+    } else {
+        token_stream = new TokenStreamWriterSink(token_file, hashmap_stemmed, tracker.isIncremental());
+        if (!token_stream->isOpen()) {
+            delete token_stream;
+            return 1;
+        }
+        sinks[sink_count++] = &original_sink;
+        if (dedup_mode) {
+            sinks[sink_count++] = &duplicate_sink;
+            token_stream->setDuplicates(&duplicate_sink, dedup_mode == 2);
+        }
+        sinks[sink_count++] = token_stream;
+        dictionary = &hashmap_stemmed;
+    }
+    sinks[sink_count++] = &heaps_sink;
+    sinks[sink_count++] = &statistics;
     
-    clock_t end_original = clock();
-    double time_original = (double)(end_original - start_original) / CLOCKS_PER_SEC;
+    TokenWriterSink* csv_writer = nullptr;
+    if (write_csv) {
+        csv_writer = new TokenWriterSink("tokens.csv");
+        if (!csv_writer->isOpen()) {
+            delete csv_writer;
+            delete token_stream;
+            return 1;
+        }
+        sinks[sink_count++] = csv_writer;
+    }
     
-    int total_original = hashmap_original.getTotalCount();
-    int unique_original = hashmap_original.getUniqueCount();
+    std::chrono::steady_clock::time_point start_pass = std::chrono::steady_clock::now();
+    long long input_bytes = xml_file.getSize();
+    if (stream_window > 0) {
+        int windows = 0;
+        int articles = 0;
+        long long content_bytes = 0;
+        const char* segment;
+        long long segment_size;
+        while (stream.nextSegment(segment, segment_size)) {
+            CorpusView window;
+            window.build(segment, segment_size);
+            articles += window.getCount();
+            content_bytes += window.getContentBytes();
+            if (!approximate) {
+                tracker.select(window);
+                if (dedup_mode) {
+                    duplicate_sink.setReused(tracker.getReusedIds(), tracker.getReusedNext(), tracker.getReusedCount());
+                }
+            }
+            runAnalyzer(window, dictionary, sinks, sink_count, num_threads, statistics);
+            windows++;
+        }
+        input_bytes = stream.getBytesRead();
+        
+        std::cout << "Прочитано: " << input_bytes << " байт, окон: " << windows
+                  << ", буфер: " << stream.getBufferSize() / (1024 * 1024) << " МБ" << std::endl;
+        std::cout << "Найдено статей: " << articles << std::endl;
+        std::cout << "Извлечено текста: " << content_bytes << " байт" << std::endl;
+        
+        if (articles == 0) {
+            std::cerr << "Ошибка: не удалось извлечь текст из XML!" << std::endl;
+            return 1;
+        }
+    } else {
+        if (!approximate) {
+            tracker.select(corpus);
+            if (dedup_mode) {
+                duplicate_sink.setReused(tracker.getReusedIds(), tracker.getReusedNext(), tracker.getReusedCount());
+            }
+        }
+        runAnalyzer(corpus, dictionary, sinks, sink_count, num_threads, statistics);
+    }
     
-    std::cout << "Всего токенов: " << total_original << std::endl;
-    std::cout << "Уникальных токенов: " << unique_original << std::endl;
-    std::cout << "Время: " << time_original << " сек" << std::endl;
+    int deleted_count = 0;
+    int* deleted_ids = tracker.collectDeleted(deleted_count);
+    if (tracker.isIncremental()) {
+        token_stream->setDeleted(deleted_ids, deleted_count);
+        std::cout << "Статей новых: " << tracker.getAdded() << ", изменённых: " << tracker.getChanged()
+                  << ", без изменений: " << tracker.getUnchanged() << ", удалённых: " << deleted_count
+                  << ", дубликатов на перепроверку: " << tracker.getRequeued() << std::endl;
+    }
+    finishSinks(sinks, sink_count);
+    if (dedup_mode) {
+        std::cout << "Почти-дубликатов (Жаккар >= " << DUPLICATE_JACCARD << "): " << duplicate_sink.getDuplicateCount()
+                  << " в " << duplicate_sink.getClusterCount() << " кластерах" << std::endl;
+    }
+    delete[] deleted_ids;
     
+    bool stream_ready = !approximate;
+    if (tracker.isIncremental()) {
+        TokenDeltaMerger merger;
+        stream_ready = merger.apply("tokens.bin", token_file);
+        if (stream_ready) {
+            std::cout << "Дельта применена к tokens.bin: " << merger.getDocCount() << " документов, "
+                      << merger.getTokenCount() << " токенов, " << merger.getTermCount() << " термов" << std::endl;
+        } else {
+            std::cerr << "Дельта не применена, манифест не обновлён" << std::endl;
+        }
+    }
+    if (stream_ready && (!dedup_mode || !duplicate_sink.saveSignatures(signature_file))) {
+        remove(signature_file);
+    } else if (stream_ready) {
+        std::cout << "Подписи канонических статей сохранены в " << signature_file << std::endl;
+    }
+    if (stream_ready && tracker.save(manifest_file)) {
+        std::cout << "Манифест статей сохранён в " << manifest_file << std::endl;
+    }
+    std::chrono::steady_clock::time_point end_pass = std::chrono::steady_clock::now();
+    double time_pass = std::chrono::duration<double>(end_pass - start_pass).count();
     
-    std::cout << "\n4. ТОКЕНИЗАЦИЯ СО СТЕММИНГОМ" << std::endl;
+    long long total_original;
+    int unique_original;
+    long long total_stemmed;
+    int unique_stemmed;
+    FreqPair* freq_original = nullptr;
+    FreqPair* freq_stemmed = nullptr;
+    FreqPair* top_original;
+    FreqPair* top_stemmed;
     
-    clock_t start_stemmed = clock();
+    if (approximate) {
+        total_original = sketch_original.getTotal();
+        unique_original = sketch_original.getUniqueEstimate();
+        total_stemmed = sketch_stemmed.getTotal();
+        unique_stemmed = sketch_stemmed.getUniqueEstimate();
+        top_original = sketch_original.topK(REPORT_TOP_K);
+        top_stemmed = sketch_stemmed.topK(REPORT_TOP_K);
+    } else {
+        total_original = hashmap_original.getTotalCount();
+        unique_original = hashmap_original.getUniqueCount();
+        total_stemmed = hashmap_stemmed.getTotalCount();
+        unique_stemmed = hashmap_stemmed.getUniqueCount();
+        
+        freq_original = hashmap_original.toArray();
+        top_original = selectTopK(freq_original, unique_original, REPORT_TOP_K);
+        
+        freq_stemmed = hashmap_stemmed.toArray();
+        top_stemmed = selectTopK(freq_stemmed, unique_stemmed, REPORT_TOP_K);
+    }
     
-    HashMap hashmap_stemmed;
-    RussianStemmer stemmer;
-    tokenizeWithStemming(text, hashmap_stemmed, stemmer);
+    std::cout << "Время: " << time_pass << " сек" << std::endl;
     
-    clock_t end_stemmed = clock();
-    double time_stemmed = (double)(end_stemmed - start_stemmed) / CLOCKS_PER_SEC;
+    if (total_stemmed == 0) {
+        std::cout << "\nНовых токенов нет, частотный анализ пропущен" << std::endl;
+        freeFreqArray(freq_original);
+        freeFreqArray(freq_stemmed);
+        freeFreqArray(top_original);
+        freeFreqArray(top_stemmed);
+        delete csv_writer;
+        delete token_stream;
+        return 0;
+    }
     
-    int total_stemmed = hashmap_stemmed.getTotalCount();
-    int unique_stemmed = hashmap_stemmed.getUniqueCount();
     
-    std::cout << "Всего токенов: " << total_stemmed << std::endl;
-    std::cout << "Уникальных токенов: " << unique_stemmed << std::endl;
-    std::cout << "Время: " << time_stemmed << " сек" << std::endl;
+    std::cout << "\n4. СТАТИСТИКА ПРОХОДА" << std::endl;
+    statistics.print(time_pass, input_bytes);
+    if (approximate) {
+        std::cout << "Память под скетчи: " << (sketch_original.getBytes() + sketch_stemmed.getBytes()) / 1024
+                  << " КБ (кандидатов в частые: " << sketch_original.getCandidateCount() << " / "
+                  << sketch_stemmed.getCandidateCount() << ")" << std::endl;
+    } else {
+        std::cout << "Память под строки словарей (арена): "
+                  << (hashmap_original.getStringBytes() + hashmap_stemmed.getStringBytes()) / 1024 << " КБ" << std::endl;
+    }
     
     
     std::cout << "\n5. СРАВНЕНИЕ: БЕЗ СТЕММИНГА vs СО СТЕММИНГОМ" << std::endl;
@@ -865,11 +4822,11 @@ int main() {
     
     std::cout << "\nБез стемминга:" << std::endl;
     std::cout << "  Общее количество токенов: " << total_original << std::endl;
-    std::cout << "  Уникальных токенов: " << unique_original << std::endl;
+    std::cout << "  Уникальных токенов: " << unique_original << (approximate ? " (оценка)" : "") << std::endl;
     
     std::cout << "\nСо стеммингом:" << std::endl;
     std::cout << "  Общее количество токенов: " << total_stemmed << std::endl;
-    std::cout << "  Уникальных токенов: " << unique_stemmed << std::endl;
+    std::cout << "  Уникальных токенов: " << unique_stemmed << (approximate ? " (оценка)" : "") << std::endl;
     
     int reduction = unique_original - unique_stemmed;
     double reduction_percent = (reduction * 100.0) / unique_original;
@@ -878,28 +4835,19 @@ int main() {
               << " (" << reduction_percent << "%)" << std::endl;
     
     
-    FreqPair* freq_original = hashmap_original.toArray();
-    sortFreqArray(freq_original, unique_original);
-    
-    FreqPair* freq_stemmed = hashmap_stemmed.toArray();
-    sortFreqArray(freq_stemmed, unique_stemmed);
-    
-    
-    printTopTokens(freq_original, unique_original, total_original, 
+    printTopTokens(top_original, unique_original, total_original, 
                    "ТОП-30 ТОКЕНОВ БЕЗ СТЕММИНГА");
     
-    printTopTokens(freq_stemmed, unique_stemmed, total_stemmed, 
+    printTopTokens(top_stemmed, unique_stemmed, total_stemmed, 
                    "ТОП-30 ТОКЕНОВ СО СТЕММИНГОМ");
     
     
     std::cout << "\n=== ПРОИЗВОДИТЕЛЬНОСТЬ ===" << std::endl;
-    std::cout << "Время токенизации БЕЗ стемминга: " << time_original << " сек" << std::endl;
-    std::cout << "Время токенизации СО стеммингом: " << time_stemmed << " сек" << std::endl;
-    std::cout << "Замедление из-за стемминга: " 
-              << ((time_stemmed - time_original) / time_original * 100.0) << "%" << std::endl;
+    std::cout << "Время единого прохода (токенизация, стемминг, запись): " << time_pass << " сек" << std::endl;
+    std::cout << "Потоков анализа: " << num_threads << std::endl;
     
     
-    analyzeZipfLaw(freq_stemmed, unique_stemmed, total_stemmed, 
+    analyzeZipfLaw(top_stemmed, unique_stemmed, total_stemmed, 
                    "ЗАКОН ЦИПФА (стеммированные токены)");
     
     
@@ -911,7 +4859,7 @@ int main() {
     
     for (int i = 0; i < compare_count; i++) {
         int rank = i + 1;
-        int real_freq = freq_stemmed[i].freq;
+        int real_freq = top_stemmed[i].freq;
         double zipf_freq = C / rank;
         double deviation = (real_freq - zipf_freq) / zipf_freq * 100;
         total_deviation += fabs(deviation);
@@ -937,16 +4885,112 @@ int main() {
     std::cout << "5. Особенности языка (служебные слова)" << std::endl;
     
     
-    std::cout << "\n=== СОХРАНЕНИЕ ТОКЕНОВ ДЛЯ ИНДЕКСАЦИИ ===" << std::endl;
-    int xml_size_for_save;
-    char* xml_for_save = readFile("../lab2/articles.xml", xml_size_for_save);
-    saveTokensForIndexing(xml_for_save, xml_size_for_save, stemmer, "tokens.csv");
-    delete[] xml_for_save;
+    std::cout << "\n=== РЕГРЕССИЯ В ЛОГАРИФМИЧЕСКИХ КООРДИНАТАХ ===" << std::endl;
+    
+    FreqPair* ranked;
+    int ranked_size;
+    double time_sort = 0;
+    int ranked_count;
+    if (approximate) {
+        ranked_count = sketch_stemmed.getCandidateCount();
+        ranked = sketch_stemmed.topK(ranked_count);
+        ranked_size = ranked_count;
+        // Порог N/k гарантирует только состав: все токены чаще N/k среди
+        // кандидатов. Сами частоты остаются оценкой сверху с ошибкой до N/k
+        if (sketch_stemmed.isSaturated()) {
+            ranked_size = 0;
+            while (ranked_size < ranked_count && ranked[ranked_size].freq > total_stemmed / ranked_count) {
+                ranked_size++;
+            }
+        }
+    } else {
+        std::chrono::steady_clock::time_point start_sort = std::chrono::steady_clock::now();
+        sortFreqArray(freq_stemmed, unique_stemmed, num_threads);
+        time_sort = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_sort).count();
+        ranked = freq_stemmed;
+        ranked_size = unique_stemmed;
+        ranked_count = unique_stemmed;
+    }
+    
+    double* zipf_x = new double[ranked_size > 0 ? ranked_size : 1];
+    double* zipf_y = new double[ranked_size > 0 ? ranked_size : 1];
+    double* zipf_log_x = new double[ranked_size > 0 ? ranked_size : 1];
+    double* zipf_log_y = new double[ranked_size > 0 ? ranked_size : 1];
+    for (int i = 0; i < ranked_size; i++) {
+        zipf_x[i] = i + 1;
+        zipf_y[i] = ranked[i].freq;
+    }
+    LinearFit zipf_fit = fitPowerLaw(zipf_x, zipf_y, ranked_size, zipf_log_x, zipf_log_y);
+    
+    int heaps_size = heaps_sink.getSampleCount();
+    double* heaps_log_x = new double[heaps_size > 0 ? heaps_size : 1];
+    double* heaps_log_y = new double[heaps_size > 0 ? heaps_size : 1];
+    LinearFit heaps_fit = fitPowerLaw(heaps_sink.getTokens(), heaps_sink.getVocabulary(), heaps_size,
+                                      heaps_log_x, heaps_log_y);
+    
+    std::cout << "Логарифмы: " << logKernel.getBackend() << std::endl;
+    std::cout << "Закон Ципфа f = C / r^s по " << zipf_fit.points
+              << (approximate ? " рангам (кандидаты Space-Saving чаще N/k, частоты завышены до N/k)" : " рангам") << ": s = " << -zipf_fit.slope
+              << ", C = " << myExp(zipf_fit.intercept) << ", R^2 = " << zipf_fit.r_squared << std::endl;
+    std::cout << "Закон Хипса V = K * n^b по " << heaps_fit.points << " точкам: K = " << myExp(heaps_fit.intercept)
+              << ", b = " << heaps_fit.slope << ", R^2 = " << heaps_fit.r_squared << std::endl;
+    if (heaps_size > 0) {
+        std::cout << "Прогноз словаря основ: x2 корпуса - "
+                  << (long long)myExp(heaps_fit.intercept + heaps_fit.slope * myLog(2.0 * total_stemmed))
+                  << ", x10 корпуса - "
+                  << (long long)myExp(heaps_fit.intercept + heaps_fit.slope * myLog(10.0 * total_stemmed))
+                  << std::endl;
+    }
+    
+    if (laws_prefix) {
+        char path[512];
+        int prefix_len = myStrlen(laws_prefix);
+        if (prefix_len > 480) prefix_len = 480;
+        for (int i = 0; i < prefix_len; i++) {
+            path[i] = laws_prefix[i];
+        }
+        
+        myStrcpy(path + prefix_len, "_zipf.csv");
+        bool written = writeLawCsv(path, "rank,frequency,log_rank,log_frequency,fitted_frequency",
+                                   zipf_x, zipf_y, zipf_log_x, zipf_log_y, ranked_size, zipf_fit);
+        myStrcpy(path + prefix_len, "_heaps.csv");
+        written = written && writeLawCsv(path, "tokens,vocabulary,log_tokens,log_vocabulary,fitted_vocabulary",
+                                         heaps_sink.getTokens(), heaps_sink.getVocabulary(),
+                                         heaps_log_x, heaps_log_y, heaps_size, heaps_fit);
+        myStrcpy(path + prefix_len, ".json");
+        written = written && writeLawsJson(path, zipf_fit, !approximate, heaps_fit, total_stemmed, unique_stemmed);
+        if (written) {
+            std::cout << "Точки и параметры регрессии сохранены в " << laws_prefix << "_zipf.csv, "
+                      << laws_prefix << "_heaps.csv, " << laws_prefix << ".json" << std::endl;
+        }
+    }
+    
+    delete[] zipf_x;
+    delete[] zipf_y;
+    delete[] zipf_log_x;
+    delete[] zipf_log_y;
+    delete[] heaps_log_x;
+    delete[] heaps_log_y;
+    if (approximate) {
+        freeFreqArray(ranked);
+    }
+    
     
+    if (ranking_file && approximate) {
+        std::cout << "\nПолный рейтинг недоступен в приближённом режиме" << std::endl;
+    } else if (ranking_file) {
+        if (writeRanking(ranking_file, freq_stemmed, unique_stemmed)) {
+            std::cout << "\nРейтинг " << unique_stemmed << " основ сохранён в " << ranking_file
+                      << " (сортировка " << time_sort << " сек)" << std::endl;
+        }
+    }
     
-    freeFreqArray(freq_original, unique_original);
-    freeFreqArray(freq_stemmed, unique_stemmed);
-    delete[] text;
+    freeFreqArray(freq_original);
+    freeFreqArray(freq_stemmed);
+    freeFreqArray(top_original);
+    freeFreqArray(top_stemmed);
+    delete csv_writer;
+    delete token_stream;
     
     std::cout << "\n=== АНАЛИЗ ЗАВЕРШЕН ===" << std::endl;
     
@@ -1,5 +1,20 @@
 #include <iostream>
-#include <ctime>
+#include <chrono>
+#include <thread>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool myStrcmp(const char* s1, const char* s2) {
+    while (*s1 && *s2) {
+        if (*s1 != *s2) return false;
+        s1++;
+        s2++;
+    }
+    return *s1 == *s2;
+}
 
 class DynamicArray {
 private:
@@ -38,16 +53,12 @@ public:
     }
     
     int getSize() const { return size; }
+    int getCapacity() const { return capacity; }
     
     int* getData() { return data; }
     
-    
-    bool contains(int value) const {
-        for (int i = 0; i < size; i++) {
-            if (data[i] == value) return true;
-        }
-        return false;
-    }
+    void clear() { size = 0; }
+    void truncate(int newSize) { if (newSize < size) size = newSize; }
     
     
     void sort() {
@@ -81,8 +92,77 @@ private:
     }
 };
 
+class Arena {
+private:
+    struct Block {
+        Block* next;
+        long long size;
+        long long used;
+    };
+    
+    static const long long BLOCK_SIZE = 1 << 20;
+    
+    Block* head;
+    long long bytes_reserved;
+    long long bytes_used;
+    
+    Block* newBlock(long long size) {
+        char* memory = new char[sizeof(Block) + size];
+        Block* block = (Block*)memory;
+        block->next = head;
+        block->size = size;
+        block->used = 0;
+        head = block;
+        bytes_reserved += size;
+        return block;
+    }
+    
+public:
+    Arena() : head(nullptr), bytes_reserved(0), bytes_used(0) {}
+    
+    ~Arena() {
+        release();
+    }
+    
+    void* allocate(long long bytes) {
+        bytes = (bytes + 7) & ~7LL;
+        
+        if (!head || head->used + bytes > head->size) {
+            newBlock(bytes > BLOCK_SIZE ? bytes : BLOCK_SIZE);
+        }
+        
+        char* result = (char*)(head + 1) + head->used;
+        head->used += bytes;
+        bytes_used += bytes;
+        return result;
+    }
+    
+    char* copyString(const char* str, int len) {
+        char* result = (char*)allocate(len + 1);
+        for (int i = 0; i < len; i++) {
+            result[i] = str[i];
+        }
+        result[len] = '\0';
+        return result;
+    }
+    
+    void release() {
+        while (head) {
+            Block* next = head->next;
+            delete[] (char*)head;
+            head = next;
+        }
+        bytes_reserved = 0;
+        bytes_used = 0;
+    }
+    
+    long long getBytesUsed() const { return bytes_used; }
+    long long getBytesReserved() const { return bytes_reserved; }
+};
+
 class StringArray {
 private:
+    Arena strings;
     char** data;
     int capacity;
     int size;
@@ -103,9 +183,6 @@ public:
     }
     
     ~StringArray() {
-        for (int i = 0; i < size; i++) {
-            delete[] data[i];
-        }
         delete[] data;
     }
     
@@ -117,10 +194,7 @@ public:
         int len = 0;
         while (str[len] != '\0') len++;
         
-        data[size] = new char[len + 1];
-        for (int i = 0; i <= len; i++) {
-            data[size][i] = str[i];
-        }
+        data[size] = strings.copyString(str, len);
         size++;
     }
     
@@ -136,129 +210,391 @@ public:
     char** getData() { return data; }
 };
 
+/*
+ПОСТИНГ-ЛИСТ: пары (DOC_ID, TF) в двух параллельных массивах. Токены
+приходят сгруппированными по документам с возрастающими DOC_ID, поэтому
+новый DOC_ID сравнивается только с последним: равен - растёт TF, больше -
+добавляется пара. Лист отсортирован и без повторов по построению, и
+finalize его не трогает. DOC_ID меньше последнего (CSV в произвольном
+порядке, пересекающиеся части) помечает лист, и finalize сортирует пары
+слиянием, складывая TF совпавших документов.
+*/
+
 struct PostingList {
     DynamicArray docIds;
+    DynamicArray termFreqs;
+    bool outOfOrder;
+    
+    PostingList() : outOfOrder(false) {}
+    
+    void clear() {
+        docIds.clear();
+        termFreqs.clear();
+        outOfOrder = false;
+    }
+    
+    // Готовая пара (например, из прогона SPIMI); повтор DOC_ID тоже уходит в слияние
+    void addPosting(int docId, int termFreq) {
+        int size = docIds.getSize();
+        if (size > 0 && docId <= docIds.getData()[size - 1]) outOfOrder = true;
+        docIds.add(docId);
+        termFreqs.add(termFreq);
+    }
     
     void addDocument(int docId) {
-        if (!docIds.contains(docId)) {
-            docIds.add(docId);
+        int size = docIds.getSize();
+        if (size > 0) {
+            int last = docIds.getData()[size - 1];
+            if (last == docId) {
+                termFreqs.getData()[size - 1]++;
+                return;
+            }
+            if (docId < last) outOfOrder = true;
         }
+        docIds.add(docId);
+        termFreqs.add(1);
     }
     
-    void finalize() {
-        docIds.sort();
+    // Дописывает лист следующей части; порядок проверяется только на стыке
+    void append(PostingList& other) {
+        int size = docIds.getSize();
+        if (other.outOfOrder ||
+            (size > 0 && other.docIds.getSize() > 0 && other.docIds.getData()[0] <= docIds.getData()[size - 1])) {
+            outOfOrder = true;
+        }
+        for (int i = 0; i < other.docIds.getSize(); i++) {
+            docIds.add(other.docIds.getData()[i]);
+            termFreqs.add(other.termFreqs.getData()[i]);
+        }
+    }
+    
+    // true, если понадобился запасной путь слияния
+    bool finalize() {
+        if (!outOfOrder) return false;
+        mergeSortPairs();
+        outOfOrder = false;
+        return true;
+    }
+    
+    int getCapacity() const { return docIds.getCapacity() + termFreqs.getCapacity(); }
+    
+private:
+    void mergeSortPairs() {
+        int size = docIds.getSize();
+        int* docs = docIds.getData();
+        int* freqs = termFreqs.getData();
+        int* docBuffer = new int[size];
+        int* freqBuffer = new int[size];
+        
+        for (int width = 1; width < size; width *= 2) {
+            for (int left = 0; left < size; left += 2 * width) {
+                int middle = left + width < size ? left + width : size;
+                int right = left + 2 * width < size ? left + 2 * width : size;
+                int i = left, j = middle, k = left;
+                while (i < middle && j < right) {
+                    if (docs[j] < docs[i]) {
+                        docBuffer[k] = docs[j];
+                        freqBuffer[k++] = freqs[j++];
+                    } else {
+                        docBuffer[k] = docs[i];
+                        freqBuffer[k++] = freqs[i++];
+                    }
+                }
+                while (i < middle) {
+                    docBuffer[k] = docs[i];
+                    freqBuffer[k++] = freqs[i++];
+                }
+                while (j < right) {
+                    docBuffer[k] = docs[j];
+                    freqBuffer[k++] = freqs[j++];
+                }
+            }
+            for (int i = 0; i < size; i++) {
+                docs[i] = docBuffer[i];
+                freqs[i] = freqBuffer[i];
+            }
+        }
+        
+        int unique = size > 0 ? 1 : 0;
+        for (int i = 1; i < size; i++) {
+            if (docs[i] == docs[unique - 1]) {
+                freqs[unique - 1] += freqs[i];
+            } else {
+                docs[unique] = docs[i];
+                freqs[unique++] = freqs[i];
+            }
+        }
+        docIds.truncate(unique);
+        termFreqs.truncate(unique);
+        
+        delete[] docBuffer;
+        delete[] freqBuffer;
     }
 };
 
-struct TermEntry {
-    char* term;
-    PostingList postings;
-    TermEntry* next;
+/*
+Открытая адресация с вытеснением Robin Hood: таблица хранит кэшированный
+хеш, длину ключа и индекс записи во внешнем плотном массиве. Ключи короче
+INLINE_KEY_SIZE байт лежат прямо в слоте, длинные - указателем на строку
+владельца. При заполнении на 80% таблица удваивается без пересчёта хешей.
+*/
+
+const int INLINE_KEY_SIZE = 20;
+
+unsigned int hashBytes(const char* str, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+class OpenHashTable {
+private:
+    struct Slot {
+        unsigned int hash;
+        int index;
+        unsigned short length;
+        unsigned short distance;
+        union {
+            char inline_key[INLINE_KEY_SIZE];
+            const char* key;
+        };
+    };
+    
+    Slot* slots;
+    unsigned int capacity;
+    unsigned int mask;
+    int count;
+    
+    static const char* keyOf(const Slot& slot) {
+        return slot.length < INLINE_KEY_SIZE ? slot.inline_key : slot.key;
+    }
     
-    TermEntry(const char* t) : next(nullptr) {
-        int len = 0;
-        while (t[len] != '\0') len++;
-        term = new char[len + 1];
-        for (int i = 0; i <= len; i++) {
-            term[i] = t[i];
+    static bool sameKey(const Slot& slot, const char* key, int len) {
+        const char* stored = keyOf(slot);
+        for (int i = 0; i < len; i++) {
+            if (stored[i] != key[i]) return false;
+        }
+        return true;
+    }
+    
+    void place(Slot candidate) {
+        unsigned int pos = candidate.hash & mask;
+        candidate.distance = 1;
+        
+        while (true) {
+            Slot& slot = slots[pos];
+            if (slot.distance == 0) {
+                slot = candidate;
+                return;
+            }
+            if (slot.distance < candidate.distance) {
+                Slot displaced = slot;
+                slot = candidate;
+                candidate = displaced;
+            }
+            candidate.distance++;
+            pos = (pos + 1) & mask;
+        }
+    }
+    
+    void grow() {
+        Slot* old_slots = slots;
+        unsigned int old_capacity = capacity;
+        
+        capacity *= 2;
+        mask = capacity - 1;
+        slots = new Slot[capacity];
+        for (unsigned int i = 0; i < capacity; i++) {
+            slots[i].distance = 0;
+        }
+        
+        for (unsigned int i = 0; i < old_capacity; i++) {
+            if (old_slots[i].distance != 0) {
+                place(old_slots[i]);
+            }
+        }
+        delete[] old_slots;
+    }
+    
+public:
+    OpenHashTable(unsigned int initial_capacity = 1024) : capacity(initial_capacity), count(0) {
+        mask = capacity - 1;
+        slots = new Slot[capacity];
+        for (unsigned int i = 0; i < capacity; i++) {
+            slots[i].distance = 0;
+        }
+    }
+    
+    ~OpenHashTable() {
+        delete[] slots;
+    }
+    
+    int find(const char* key, int len, unsigned int hash) const {
+        unsigned int pos = hash & mask;
+        unsigned short distance = 1;
+        
+        while (true) {
+            const Slot& slot = slots[pos];
+            if (slot.distance < distance) return -1;
+            if (slot.hash == hash && slot.length == len && sameKey(slot, key, len)) {
+                return slot.index;
+            }
+            distance++;
+            pos = (pos + 1) & mask;
+        }
+    }
+    
+    void insert(const char* stable_key, int len, unsigned int hash, int index) {
+        if ((unsigned int)(count + 1) * 5 > capacity * 4) {
+            grow();
         }
+        
+        Slot candidate;
+        candidate.hash = hash;
+        candidate.index = index;
+        candidate.length = (unsigned short)len;
+        if (len < INLINE_KEY_SIZE) {
+            for (int i = 0; i < len; i++) {
+                candidate.inline_key[i] = stable_key[i];
+            }
+        } else {
+            candidate.key = stable_key;
+        }
+        
+        place(candidate);
+        count++;
     }
     
-    ~TermEntry() {
-        delete[] term;
+    int getCount() const { return count; }
+    unsigned int getCapacity() const { return capacity; }
+    long long getBytes() const { return (long long)capacity * sizeof(Slot); }
+};
+
+struct TermEntry {
+    char* term;
+    int length;
+    PostingList postings;
+    
+    TermEntry(const char* t, int len, Arena& arena) : length(len) {
+        term = arena.copyString(t, len);
     }
 };
 
 class InvertedIndex {
 private:
-    static const int TABLE_SIZE = 20011; 
-    TermEntry** table;
+    OpenHashTable table;
+    Arena arena;
+    TermEntry** entries;
+    int entriesCapacity;
+    TermEntry** byId;
+    int byIdSize;
     int uniqueTerms;
     long long totalTermOccurrences;
+    long long postingBytes;
     
-    unsigned long hash(const char* str) const {
-        unsigned long hash = 5381;
-        int c;
-        while ((c = *str++)) {
-            hash = ((hash << 5) + hash) + c;
-        }
-        return hash % TABLE_SIZE;
+    void addPosting(TermEntry* entry, int docId) {
+        int capacity = entry->postings.getCapacity();
+        entry->postings.addDocument(docId);
+        postingBytes += (entry->postings.getCapacity() - capacity) * sizeof(int);
+        totalTermOccurrences++;
     }
     
-    bool streq(const char* s1, const char* s2) const {
-        int i = 0;
-        while (s1[i] != '\0' && s2[i] != '\0') {
-            if (s1[i] != s2[i]) return false;
-            i++;
+    int createEntry(const char* term, int len, unsigned int hash) {
+        if (uniqueTerms >= entriesCapacity) {
+            entriesCapacity *= 2;
+            TermEntry** newEntries = new TermEntry*[entriesCapacity];
+            for (int i = 0; i < uniqueTerms; i++) {
+                newEntries[i] = entries[i];
+            }
+            delete[] entries;
+            entries = newEntries;
         }
-        return s1[i] == s2[i];
+        
+        TermEntry* entry = new (arena.allocate(sizeof(TermEntry))) TermEntry(term, len, arena);
+        postingBytes += entry->postings.getCapacity() * sizeof(int);
+        entries[uniqueTerms] = entry;
+        table.insert(entry->term, len, hash, uniqueTerms);
+        return uniqueTerms++;
     }
     
 public:
-    InvertedIndex() : uniqueTerms(0), totalTermOccurrences(0) {
-        table = new TermEntry*[TABLE_SIZE];
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            table[i] = nullptr;
-        }
+    InvertedIndex() : entriesCapacity(1024), byId(nullptr), byIdSize(0),
+                      uniqueTerms(0), totalTermOccurrences(0), postingBytes(0) {
+        entries = new TermEntry*[entriesCapacity];
     }
     
     ~InvertedIndex() {
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            TermEntry* entry = table[i];
-            while (entry) {
-                TermEntry* next = entry->next;
-                delete entry;
-                entry = next;
-            }
+        for (int i = 0; i < uniqueTerms; i++) {
+            entries[i]->~TermEntry();
         }
-        delete[] table;
+        delete[] entries;
+        delete[] byId;
     }
     
-    void addTerm(const char* term, int docId) {
-        unsigned long idx = hash(term);
-        TermEntry* entry = table[idx];
-        
+    void reserveTermIds(int count) {
+        delete[] byId;
+        byIdSize = count;
+        byId = new TermEntry*[byIdSize];
+        for (int i = 0; i < byIdSize; i++) {
+            byId[i] = nullptr;
+        }
+    }
+    
+    void addTermById(int termId, const char* term, int len, int docId) {
+        TermEntry* entry = byId[termId];
         
-        while (entry) {
-            if (streq(entry->term, term)) {
-                entry->postings.addDocument(docId);
-                totalTermOccurrences++;
-                return;
-            }
-            entry = entry->next;
+        if (!entry) {
+            int index = createEntry(term, len, hashBytes(term, len));
+            entry = entries[index];
+            byId[termId] = entry;
         }
         
+        addPosting(entry, docId);
+    }
+    
+    void addTerm(const char* term, int len, int docId) {
+        unsigned int hash = hashBytes(term, len);
+        int index = table.find(term, len, hash);
         
-        TermEntry* newEntry = new TermEntry(term);
-        newEntry->postings.addDocument(docId);
-        newEntry->next = table[idx];
-        table[idx] = newEntry;
-        uniqueTerms++;
-        totalTermOccurrences++;
+        if (index < 0) {
+            index = createEntry(term, len, hash);
+        }
+        
+        addPosting(entries[index], docId);
     }
     
     int getUniqueTerms() const { return uniqueTerms; }
     long long getTotalOccurrences() const { return totalTermOccurrences; }
     
+    TermEntry* getById(int termId) const { return byId[termId]; }
+    
+    // Память, растущая вместе с блоком; массив byId фиксирован размером словаря и не учитывается,
+    // а от арены берутся занятые байты - её блоки по 1 МБ выделяются заранее
+    long long getMemoryUsage() const {
+        return arena.getBytesUsed() + table.getBytes() +
+               (long long)entriesCapacity * sizeof(TermEntry*) + postingBytes;
+    }
+    
     void getAllTerms(TermEntry** result, int& count) const {
         count = 0;
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            TermEntry* entry = table[i];
-            while (entry) {
-                result[count++] = entry;
-                entry = entry->next;
-            }
+        for (int i = 0; i < uniqueTerms; i++) {
+            result[count++] = entries[i];
         }
     }
     
-    void finalizeAllPostings() {
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            TermEntry* entry = table[i];
-            while (entry) {
-                entry->postings.finalize();
-                entry = entry->next;
-            }
+    // Возвращает число листов, которым понадобилось слияние
+    int finalizeAllPostings() {
+        int merged = 0;
+        for (int i = 0; i < uniqueTerms; i++) {
+            if (entries[i]->postings.finalize()) merged++;
         }
+        return merged;
     }
 };
 
@@ -313,6 +649,15 @@ public:
     
     int getSize() const { return size; }
     
+    void append(const ForwardIndex& other) {
+        for (int i = 0; i < other.size; i++) {
+            if (size >= capacity) {
+                resize();
+            }
+            documents[size++] = other.documents[i];
+        }
+    }
+    
     const DocumentMetadata* getDocument(int index) const {
         if (index >= 0 && index < size) {
             return &documents[index];
@@ -323,6 +668,16 @@ public:
     DocumentMetadata* getAllDocuments() { return documents; }
 };
 
+// Тот же порядок, что в quickSortTerms и бинарном поиске lab7: побайтно как char, префикс раньше
+int compareTerms(const char* a, int aLen, const char* b, int bLen) {
+    int len = aLen < bLen ? aLen : bLen;
+    for (int i = 0; i < len; i++) {
+        if (a[i] < b[i]) return -1;
+        if (a[i] > b[i]) return 1;
+    }
+    return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
 void quickSortTerms(TermEntry** arr, int low, int high) {
     if (low < high) {
         TermEntry* pivot = arr[high];
@@ -365,10 +720,21 @@ void quickSortTerms(TermEntry** arr, int low, int high) {
     }
 }
 
-class CSVParser {
+class TokenSource {
+public:
+    virtual ~TokenSource() {}
+    virtual bool open(const char* filename) = 0;
+    virtual bool readNext(int& docId, int& termId, const char*& term, int& termLen,
+                          int& position, int& offset) = 0;
+    virtual int getTermCount() const { return 0; }
+    virtual bool isDuplicate(int) const { return false; }
+};
+
+class CSVParser : public TokenSource {
 private:
     FILE* file;
     char line[2048];
+    char token[256];
     
 public:
     CSVParser() : file(nullptr) {}
@@ -377,7 +743,7 @@ public:
         if (file) fclose(file);
     }
     
-    bool open(const char* filename) {
+    bool open(const char* filename) override {
         file = fopen(filename, "r");
         if (!file) {
             std::cerr << "Ошибка открытия файла: " << filename << std::endl;
@@ -390,7 +756,8 @@ public:
         return true;
     }
     
-    bool readNext(int& docId, char* token) {
+    bool readNext(int& docId, int& termId, const char*& term, int& termLen,
+                  int& position, int& offset) override {
         if (!file || feof(file)) return false;
         
         if (!fgets(line, sizeof(line), file)) {
@@ -421,244 +788,1471 @@ public:
         }
         token[j] = '\0';
         
+        termId = -1;
+        term = token;
+        termLen = j;
+        position = -1;
+        offset = -1;
         return true;
     }
 };
 
-class SimpleXMLParser {
+class MappedFile {
 private:
-    char* content;
-    long contentSize;
-    
-    bool startsWith(const char* str, const char* prefix, long pos) const {
-        int i = 0;
-        while (prefix[i] != '\0') {
-            if (pos + i >= contentSize || str[pos + i] != prefix[i]) return false;
-            i++;
-        }
-        return true;
-    }
-    
-    void extractText(const char* xml, long start, long end, char* result) const {
-        int resIdx = 0;
-        for (long i = start; i < end && resIdx < 510; i++) {
-            if (xml[i] != '\n' && xml[i] != '\r') {
-                result[resIdx++] = xml[i];
-            }
-        }
-        result[resIdx] = '\0';
-    }
+    int fd;
+    const char* data;
+    long long size;
     
 public:
-    SimpleXMLParser() : content(nullptr), contentSize(0) {}
+    MappedFile() : fd(-1), data(nullptr), size(0) {}
     
-    ~SimpleXMLParser() {
-        if (content) delete[] content;
+    ~MappedFile() {
+        close();
     }
     
-    bool loadFile(const char* filename) {
-        FILE* file = fopen(filename, "rb");
-        if (!file) return false;
+    bool open(const char* filename) {
+        fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
         
-        fseek(file, 0, SEEK_END);
-        contentSize = ftell(file);
-        fseek(file, 0, SEEK_SET);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close();
+            return false;
+        }
+        size = st.st_size;
         
-        content = new char[contentSize + 1];
-        fread(content, 1, contentSize, file);
-        content[contentSize] = '\0';
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close();
+            return false;
+        }
         
-        fclose(file);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*)mapped;
         return true;
     }
     
-    void extractURLs(StringArray& urls) {
-        long pos = 0;
-        
-        while (pos < contentSize) {
-            
-            if (startsWith(content, "<url>", pos)) {
-                long start = pos + 5;
-                long end = start;
-                
-                
-                while (end < contentSize && !startsWith(content, "</url>", end)) {
-                    end++;
-                }
-                
-                if (end < contentSize) {
-                    char url[512];
-                    extractText(content, start, end, url);
-                    urls.add(url);
-                    pos = end + 6;
-                } else {
-                    break;
-                }
-            } else {
-                pos++;
-            }
+    void close() {
+        if (data) {
+            munmap((void*)data, size);
+            data = nullptr;
         }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        size = 0;
     }
+    
+    const char* getData() const { return data; }
+    long long getSize() const { return size; }
 };
 
 /*
-ФОРМАТ ФАЙЛА INDEX.BIN:
-
-ЗАГОЛОВОК (HEADER):
-[0-3]   MAGIC NUMBER: "SIDX" (4 байта)
-[4-7]   VERSION: 1 (4 байта, uint32)
-[8-11]  NUM_TERMS: количество уникальных термов (4 байта, uint32)
-[12-15] NUM_DOCS: количество документов (4 байта, uint32)
-[16-23] INVERTED_INDEX_OFFSET: смещение до инвертированного индекса (8 байт, uint64)
-[24-31] FORWARD_INDEX_OFFSET: смещение до прямого индекса (8 байт, uint64)
-
-ИНВЕРТИРОВАННЫЙ ИНДЕКС (начинается с INVERTED_INDEX_OFFSET):
-Для каждого терма (отсортированы лексикографически):
-  [0-1]   TERM_LENGTH: длина терма (2 байта, uint16)
-  [2-N]   TERM: строка терма (TERM_LENGTH байт)
-  [N+1-N+4] DOC_COUNT: количество документов (4 байта, uint32)
-  [N+5...] DOC_IDS: список ID документов (DOC_COUNT * 4 байта, каждый uint32)
-
-ПРЯМОЙ ИНДЕКС (начинается с FORWARD_INDEX_OFFSET):
-Для каждого документа:
-  [0-3]   DOC_ID: ID документа (4 байта, uint32)
-  [4-5]   URL_LENGTH: длина URL (2 байта, uint16)
-  [6-N]   URL: строка URL (URL_LENGTH байт)
-  [N+1-N+4] TERM_COUNT: количество термов в документе (4 байта, uint32)
+ЧТЕНИЕ TOKENS.BIN (формат описан в lab3-5/tokenizer_zipfs_stemming.cpp):
+файл отображается в память, токены возвращаются указателями прямо в
+отображение, без копирования и без разбора текста. Версия 2 содержит
+словарь термов, поэтому вместе с токеном возвращается его TERM_ID.
+Версия 3 добавляет порядковый номер слова и байтовое смещение токена в
+документе; для старых версий они равны -1.
 */
 
-class BinaryIndexWriter {
+struct TokenCursor {
+    const unsigned char* ptr;
+    const unsigned char* end;
+    int currentDocId;
+    unsigned int tokensLeft;
+    int lastPosition;
+    int lastOffset;
+    
+    void reset(const unsigned char* begin, const unsigned char* limit) {
+        ptr = begin;
+        end = limit;
+        currentDocId = -1;
+        tokensLeft = 0;
+        lastPosition = 0;
+        lastOffset = 0;
+    }
+};
+
+class TokenStreamReader : public TokenSource {
 private:
-    FILE* file;
+    MappedFile mapped;
+    const unsigned char* ptr;
+    const unsigned char* end;
+    unsigned int version;
+    unsigned int docCount;
+    unsigned long long tokenCount;
+    int termCount;
+    const char** terms;
+    unsigned char* termLengths;
+    unsigned int flags;
+    unsigned int deletedCount;
+    unsigned int duplicateCount;
+    bool* duplicateFlags;
+    int duplicateLimit;
+    TokenCursor cursor;
+    
+    static unsigned int readUInt32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
     
-    void writeUInt32(unsigned int value) {
-        unsigned char bytes[4];
-        bytes[0] = value & 0xFF;
-        bytes[1] = (value >> 8) & 0xFF;
-        bytes[2] = (value >> 16) & 0xFF;
-        bytes[3] = (value >> 24) & 0xFF;
-        fwrite(bytes, 1, 4, file);
+    static unsigned long long readUInt64(const unsigned char* p) {
+        return readUInt32(p) | ((unsigned long long)readUInt32(p + 4) << 32);
     }
     
-    void writeUInt64(unsigned long long value) {
-        unsigned char bytes[8];
-        for (int i = 0; i < 8; i++) {
-            bytes[i] = (value >> (i * 8)) & 0xFF;
+    static bool readVByte(const unsigned char*& ptr, const unsigned char* end, unsigned int& value) {
+        value = 0;
+        int shift = 0;
+        while (ptr < end && (*ptr & 0x80)) {
+            value |= (unsigned int)(*ptr++ & 0x7F) << shift;
+            shift += 7;
         }
-        fwrite(bytes, 1, 8, file);
+        if (ptr >= end) return false;
+        value |= (unsigned int)(*ptr++) << shift;
+        return true;
     }
     
-    void writeUInt16(unsigned short value) {
-        unsigned char bytes[2];
-        bytes[0] = value & 0xFF;
-        bytes[1] = (value >> 8) & 0xFF;
-        fwrite(bytes, 1, 2, file);
+    // Пропускает токены блока документа, не декодируя их; nullptr - поток обрезан
+    const unsigned char* skipTokens(const unsigned char* p, unsigned int count) const {
+        if (version == 1) {
+            for (unsigned int i = 0; i < count; i++) {
+                if (p >= end || end - p - 1 < *p) return nullptr;
+                p += 1 + *p;
+            }
+            return p;
+        }
+        
+        unsigned long long values = (unsigned long long)count * (version >= 3 ? 3 : 1);
+        while (values > 0) {
+            if (p >= end) return nullptr;
+            if (!(*p++ & 0x80)) values--;
+        }
+        return p;
     }
     
-    void writeString(const char* str, int maxLen = -1) {
+    bool loadDictionary(const unsigned char* data, unsigned long long offset) {
+        if (offset > (unsigned long long)mapped.getSize()) return false;
+        
+        terms = new const char*[termCount];
+        termLengths = new unsigned char[termCount];
+        
+        const unsigned char* p = data + offset;
+        for (int i = 0; i < termCount; i++) {
+            if (p >= end || end - p - 1 < *p) return false;
+            termLengths[i] = *p;
+            terms[i] = (const char*)(p + 1);
+            p += 1 + *p;
+        }
+        
+        end = data + offset;
+        return true;
+    }
+    
+    bool loadDuplicates(const unsigned char* data, unsigned long long offset) {
+        if (offset + (unsigned long long)duplicateCount * 8 > (unsigned long long)mapped.getSize()) return false;
+        
+        const unsigned char* p = data + offset;
+        for (unsigned int i = 0; i < duplicateCount; i++) {
+            int docId = (int)readUInt32(p + i * 8);
+            if (docId >= duplicateLimit) duplicateLimit = docId + 1;
+        }
+        
+        duplicateFlags = new bool[duplicateLimit > 0 ? duplicateLimit : 1];
+        for (int i = 0; i < duplicateLimit; i++) {
+            duplicateFlags[i] = false;
+        }
+        for (unsigned int i = 0; i < duplicateCount; i++) {
+            duplicateFlags[readUInt32(p + i * 8)] = true;
+        }
+        return true;
+    }
+    
+public:
+    TokenStreamReader() : ptr(nullptr), end(nullptr), version(0), docCount(0), tokenCount(0),
+                          termCount(0), terms(nullptr), termLengths(nullptr), flags(0), deletedCount(0),
+                          duplicateCount(0), duplicateFlags(nullptr), duplicateLimit(0) {
+        cursor.reset(nullptr, nullptr);
+    }
+    
+    ~TokenStreamReader() {
+        delete[] terms;
+        delete[] termLengths;
+        delete[] duplicateFlags;
+    }
+    
+    bool open(const char* filename) override {
+        if (!mapped.open(filename)) {
+            return false;
+        }
+        
+        const unsigned char* data = (const unsigned char*)mapped.getData();
+        if (mapped.getSize() < 20 || data[0] != 'T' || data[1] != 'K' || data[2] != 'N' || data[3] != 'S') {
+            std::cerr << "Неверный формат потока токенов: " << filename << std::endl;
+            mapped.close();
+            return false;
+        }
+        
+        version = readUInt32(data + 4);
+        docCount = readUInt32(data + 8);
+        tokenCount = readUInt64(data + 12);
+        end = data + mapped.getSize();
+        
+        if (version == 1) {
+            ptr = data + 20;
+        } else if (((version == 2 || version == 3) && mapped.getSize() >= 32) ||
+                   (version == 4 && mapped.getSize() >= 48) || (version == 5 && mapped.getSize() >= 60)) {
+            termCount = readUInt32(data + 20);
+            ptr = data + 32;
+            if (version >= 4) {
+                flags = readUInt32(data + 32);
+                deletedCount = readUInt32(data + 36);
+                ptr = data + 48;
+            }
+            if (version >= 5) {
+                duplicateCount = readUInt32(data + 48);
+                ptr = data + 60;
+                if (!loadDuplicates(data, readUInt64(data + 52))) {
+                    std::cerr << "Повреждён список дубликатов: " << filename << std::endl;
+                    mapped.close();
+                    return false;
+                }
+            }
+            if (!loadDictionary(data, readUInt64(data + 24))) {
+                std::cerr << "Повреждён словарь термов: " << filename << std::endl;
+                mapped.close();
+                return false;
+            }
+        } else {
+            std::cerr << "Неподдерживаемая версия потока токенов: " << version << std::endl;
+            mapped.close();
+            return false;
+        }
+        
+        cursor.reset(ptr, end);
+        return true;
+    }
+    
+    // Читает из произвольного курсора; не меняет состояние читателя, поэтому
+    // разные потоки могут одновременно читать свои части файла
+    bool readFrom(TokenCursor& c, int& docId, int& termId, const char*& term, int& termLen,
+                  int& position, int& offset) const {
+        while (c.tokensLeft == 0) {
+            if (c.end - c.ptr < 8) return false;
+            c.currentDocId = readUInt32(c.ptr);
+            c.tokensLeft = readUInt32(c.ptr + 4);
+            c.ptr += 8;
+            c.lastPosition = 0;
+            c.lastOffset = 0;
+        }
+        
+        position = -1;
+        offset = -1;
+        if (version == 1) {
+            if (c.ptr >= c.end) return false;
+            termLen = *c.ptr++;
+            if (c.end - c.ptr < termLen) return false;
+            termId = -1;
+            term = (const char*)c.ptr;
+            c.ptr += termLen;
+        } else {
+            unsigned int id;
+            if (!readVByte(c.ptr, c.end, id) || id >= (unsigned int)termCount) return false;
+            
+            termId = id;
+            term = terms[id];
+            termLen = termLengths[id];
+            
+            if (version >= 3) {
+                unsigned int positionDelta, offsetDelta;
+                if (!readVByte(c.ptr, c.end, positionDelta) || !readVByte(c.ptr, c.end, offsetDelta)) return false;
+                c.lastPosition += positionDelta;
+                c.lastOffset += offsetDelta;
+                position = c.lastPosition;
+                offset = c.lastOffset;
+            }
+        }
+        
+        docId = c.currentDocId;
+        c.tokensLeft--;
+        return true;
+    }
+    
+    bool readNext(int& docId, int& termId, const char*& term, int& termLen,
+                  int& position, int& offset) override {
+        return readFrom(cursor, docId, termId, term, termLen, position, offset);
+    }
+    
+    /*
+    Делит блоки документов на parts примерно равных по байтам диапазонов.
+    Границы проходят только между блоками, поэтому документ целиком попадает
+    в один курсор, а курсоры идут в порядке файла. Длина блока в заголовке
+    не хранится, так что блоки пропускаются подсчётом завершающих байтов
+    VByte - это один последовательный проход без декодирования.
+    */
+    int partition(TokenCursor* cursors, int parts) const {
+        const unsigned char* begin = cursor.ptr;
+        long long total = end - begin;
+        int count = 0;
+        const unsigned char* boundary = begin + total / parts;
+        const unsigned char* p = begin;
+        
+        cursors[0].reset(begin, end);
+        while (end - p >= 8) {
+            if (p >= boundary && count + 1 < parts) {
+                cursors[count].end = p;
+                count++;
+                cursors[count].reset(p, end);
+                boundary = begin + total * (count + 1) / parts;
+            }
+            p = skipTokens(p + 8, readUInt32(p + 4));
+            if (!p) break;
+        }
+        return count + 1;
+    }
+    
+    int getTermCount() const override { return termCount; }
+    bool hasDictionary() const { return version >= 2; }
+    unsigned int getDocCount() const { return docCount; }
+    unsigned long long getTokenCount() const { return tokenCount; }
+    bool hasPositions() const { return version >= 3; }
+    bool isDelta() const { return (flags & 1) != 0; }
+    unsigned int getDeletedCount() const { return deletedCount; }
+    unsigned int getDuplicateCount() const { return duplicateCount; }
+    bool duplicatesDropped() const { return (flags & 2) != 0; }
+    
+    bool isDuplicate(int docId) const override {
+        return docId >= 0 && docId < duplicateLimit && duplicateFlags[docId];
+    }
+};
+
+class SimpleXMLParser {
+private:
+    MappedFile mapped;
+    const char* content;
+    long long contentSize;
+    
+    bool startsWith(const char* str, const char* prefix, long pos) const {
+        int i = 0;
+        while (prefix[i] != '\0') {
+            if (pos + i >= contentSize || str[pos + i] != prefix[i]) return false;
+            i++;
+        }
+        return true;
+    }
+    
+    void extractText(const char* xml, long start, long end, char* result) const {
+        int resIdx = 0;
+        for (long i = start; i < end && resIdx < 510; i++) {
+            if (xml[i] != '\n' && xml[i] != '\r') {
+                result[resIdx++] = xml[i];
+            }
+        }
+        result[resIdx] = '\0';
+    }
+    
+public:
+    SimpleXMLParser() : content(nullptr), contentSize(0) {}
+    
+    // articles.xml отображается в память, а не читается целиком в кучу
+    bool loadFile(const char* filename) {
+        if (!mapped.open(filename)) return false;
+        content = mapped.getData();
+        contentSize = mapped.getSize();
+        return true;
+    }
+    
+    void extractURLs(StringArray& urls) {
+        long pos = 0;
+        
+        while (pos < contentSize) {
+            
+            if (startsWith(content, "<url>", pos)) {
+                long start = pos + 5;
+                long end = start;
+                
+                
+                while (end < contentSize && !startsWith(content, "</url>", end)) {
+                    end++;
+                }
+                
+                if (end < contentSize) {
+                    char url[512];
+                    extractText(content, start, end, url);
+                    urls.add(url);
+                    pos = end + 6;
+                } else {
+                    break;
+                }
+            } else {
+                pos++;
+            }
+        }
+    }
+};
+
+/*
+ФОРМАТ ФАЙЛА INDEX.BIN:
+
+ЗАГОЛОВОК (HEADER):
+[0-3]   MAGIC NUMBER: "SIDX" (4 байта)
+[4-7]   VERSION: 3 (4 байта, uint32)
+[8-11]  NUM_TERMS: количество уникальных термов (4 байта, uint32)
+[12-15] NUM_DOCS: количество документов (4 байта, uint32)
+[16-23] INVERTED_INDEX_OFFSET: смещение до инвертированного индекса (8 байт, uint64)
+[24-31] FORWARD_INDEX_OFFSET: смещение до прямого индекса (8 байт, uint64)
+[32-39] TOTAL_LENGTH: сумма TERM_COUNT всех документов (8 байт, uint64);
+        avgdl = TOTAL_LENGTH / NUM_DOCS
+
+ИНВЕРТИРОВАННЫЙ ИНДЕКС (начинается с INVERTED_INDEX_OFFSET):
+Для каждого терма (отсортированы лексикографически):
+  [0-1]   TERM_LENGTH: длина терма (2 байта, uint16)
+  [2-N]   TERM: строка терма (TERM_LENGTH байт)
+  [N+1-N+4] DOC_COUNT: количество документов (4 байта, uint32)
+  [N+5]   CODEC: 0 - VByte, 1 - BP128 (1 байт)
+  [N+6-N+9] BYTE_LENGTH: длина сжатого листа (4 байта, uint32)
+  [N+10...] POSTINGS: разности DOC_ID, затем TF - 1 (BYTE_LENGTH байт)
+
+Лист хранит разности соседних DOC_ID (первая - от нуля), за ними тем же
+кодеком DOC_COUNT значений TF - 1; у большинства постингов TF = 1, и блок
+BP128 таких значений занимает один байт. DOC_COUNT терма - это df для
+BM25. VByte: по 7 бит
+на байт, старший бит - "есть продолжение". BP128: разности идут блоками
+по 128, каждый блок - байт BITS и 16 * BITS байт упаковки, хвост короче
+128 - VByte. Упаковка вертикальная, как в SIMD-BP128: значение i лежит в
+дорожке i % 4, а слово w дорожки l - по смещению (w * 4 + l) * 4, так что
+одна загрузка 128 бит даёт сразу четыре соседние разности. Кодек
+выбирается для каждого листа по меньшему суммарному размеру обоих потоков;
+листы короче 128 - VByte. В версии 2 не было TOTAL_LENGTH (заголовок 32
+байта) и потока TF; в версии 1 вместо CODEC/BYTE_LENGTH/POSTINGS шли
+DOC_COUNT * 4 байта uint32.
+
+ПРЯМОЙ ИНДЕКС (начинается с FORWARD_INDEX_OFFSET):
+Для каждого документа:
+  [0-3]   DOC_ID: ID документа (4 байта, uint32)
+  [4-5]   URL_LENGTH: длина URL (2 байта, uint16)
+  [6-N]   URL: строка URL (URL_LENGTH байт)
+  [N+1-N+4] TERM_COUNT: количество термов в документе (4 байта, uint32) -
+          длина документа dl для нормализации BM25
+*/
+
+const int INDEX_VERSION = 3;
+const int INDEX_HEADER_SIZE = 40;
+const int CODEC_VBYTE = 0;
+const int CODEC_BP128 = 1;
+const int BP128_BLOCK = 128;
+
+class BinaryIndexWriter {
+private:
+    FILE* file;
+    long long forwardIndexStart;
+    bool rawPostings;
+    unsigned char* encodeBuffer;
+    long long encodeCapacity;
+    unsigned int* gaps;
+    unsigned int* freqs;
+    long long gapCapacity;
+    unsigned long long documentLengthSum;
+    long long rawPostingBytes;
+    long long encodedPostingBytes;
+    int vbyteLists;
+    int bp128Lists;
+    
+    static int writeVByte(unsigned int value, unsigned char* out) {
+        int len = 0;
+        while (value >= 0x80) {
+            out[len++] = (unsigned char)(value | 0x80);
+            value >>= 7;
+        }
+        out[len++] = (unsigned char)value;
+        return len;
+    }
+    
+    static int vbyteSize(unsigned int value) {
+        int len = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            len++;
+        }
+        return len;
+    }
+    
+    static int bitWidth(unsigned int value) {
+        int bits = 0;
+        while (value > 0) {
+            value >>= 1;
+            bits++;
+        }
+        return bits;
+    }
+    
+    static int blockBits(const unsigned int* block) {
+        unsigned int combined = 0;
+        for (int i = 0; i < BP128_BLOCK; i++) combined |= block[i];
+        return bitWidth(combined);
+    }
+    
+    // Вертикальная упаковка 128 значений по bits бит в 4 дорожки по 32 бита
+    static void packBlock(const unsigned int* block, int bits, unsigned char* out) {
+        unsigned int words[32 * 4];
+        for (int i = 0; i < bits * 4; i++) words[i] = 0;
+        
+        for (int i = 0; i < BP128_BLOCK; i++) {
+            int lane = i & 3;
+            int bitPos = (i >> 2) * bits;
+            int word = bitPos >> 5;
+            int shift = bitPos & 31;
+            words[word * 4 + lane] |= block[i] << shift;
+            if (shift + bits > 32) {
+                words[(word + 1) * 4 + lane] |= block[i] >> (32 - shift);
+            }
+        }
+        
+        for (int i = 0; i < bits * 4; i++) {
+            out[i * 4] = words[i] & 0xFF;
+            out[i * 4 + 1] = (words[i] >> 8) & 0xFF;
+            out[i * 4 + 2] = (words[i] >> 16) & 0xFF;
+            out[i * 4 + 3] = (words[i] >> 24) & 0xFF;
+        }
+    }
+    
+    void reserveBuffers(int docCount) {
+        if (docCount > gapCapacity) {
+            delete[] gaps;
+            delete[] freqs;
+            gapCapacity = docCount * 2LL;
+            gaps = new unsigned int[gapCapacity];
+            freqs = new unsigned int[gapCapacity];
+        }
+        long long bytes = docCount * 10LL + 32;
+        if (bytes > encodeCapacity) {
+            delete[] encodeBuffer;
+            encodeCapacity = bytes * 2;
+            encodeBuffer = new unsigned char[encodeCapacity];
+        }
+    }
+    
+    static long long streamSize(const unsigned int* values, int count, int codec) {
+        long long bytes = 0;
+        int i = 0;
+        if (codec == CODEC_BP128) {
+            for (; count - i >= BP128_BLOCK; i += BP128_BLOCK) {
+                bytes += 1 + 16 * blockBits(values + i);
+            }
+        }
+        for (; i < count; i++) {
+            bytes += vbyteSize(values[i]);
+        }
+        return bytes;
+    }
+    
+    static int encodeStream(const unsigned int* values, int count, int codec, unsigned char* out) {
+        int length = 0;
+        int i = 0;
+        if (codec == CODEC_BP128) {
+            for (; count - i >= BP128_BLOCK; i += BP128_BLOCK) {
+                int bits = blockBits(values + i);
+                out[length++] = (unsigned char)bits;
+                packBlock(values + i, bits, out + length);
+                length += 16 * bits;
+            }
+        }
+        for (; i < count; i++) {
+            length += writeVByte(values[i], out + length);
+        }
+        return length;
+    }
+    
+    // Кодирует лист (разности DOC_ID, затем TF - 1) в encodeBuffer; возвращает длину
+    int encodePostings(const int* docIds, const int* termFreqs, int docCount, int& codec) {
+        reserveBuffers(docCount);
+        
+        int previous = 0;
+        for (int i = 0; i < docCount; i++) {
+            gaps[i] = (unsigned int)(docIds[i] - previous);
+            previous = docIds[i];
+            freqs[i] = (unsigned int)(termFreqs[i] - 1);
+        }
+        
+        codec = CODEC_VBYTE;
+        if (docCount >= BP128_BLOCK &&
+            streamSize(gaps, docCount, CODEC_BP128) + streamSize(freqs, docCount, CODEC_BP128) <
+            streamSize(gaps, docCount, CODEC_VBYTE) + streamSize(freqs, docCount, CODEC_VBYTE)) {
+            codec = CODEC_BP128;
+        }
+        
+        int length = encodeStream(gaps, docCount, codec, encodeBuffer);
+        length += encodeStream(freqs, docCount, codec, encodeBuffer + length);
+        return length;
+    }
+    
+    void writeUInt32(unsigned int value) {
+        unsigned char bytes[4];
+        bytes[0] = value & 0xFF;
+        bytes[1] = (value >> 8) & 0xFF;
+        bytes[2] = (value >> 16) & 0xFF;
+        bytes[3] = (value >> 24) & 0xFF;
+        fwrite(bytes, 1, 4, file);
+    }
+    
+    void writeUInt64(unsigned long long value) {
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = (value >> (i * 8)) & 0xFF;
+        }
+        fwrite(bytes, 1, 8, file);
+    }
+    
+    void writeUInt16(unsigned short value) {
+        unsigned char bytes[2];
+        bytes[0] = value & 0xFF;
+        bytes[1] = (value >> 8) & 0xFF;
+        fwrite(bytes, 1, 2, file);
+    }
+    
+    void writeString(const char* str, int maxLen = -1) {
+        int len = 0;
+        while (str[len] != '\0' && (maxLen == -1 || len < maxLen)) len++;
+        fwrite(str, 1, len, file);
+    }
+    
+public:
+    BinaryIndexWriter() : file(nullptr), forwardIndexStart(0), rawPostings(false),
+                          encodeBuffer(nullptr), encodeCapacity(0), gaps(nullptr), freqs(nullptr),
+                          gapCapacity(0), documentLengthSum(0), rawPostingBytes(0), encodedPostingBytes(0),
+                          vbyteLists(0), bp128Lists(0) {}
+    
+    ~BinaryIndexWriter() {
+        if (file) fclose(file);
+        delete[] encodeBuffer;
+        delete[] gaps;
+        delete[] freqs;
+    }
+    
+    // Прогоны SPIMI пишут DOC_ID и TF как есть, без сжатия: их читает RunReader
+    void setRawPostings(bool raw) { rawPostings = raw; }
+    
+    bool open(const char* filename) {
+        file = fopen(filename, "wb");
+        if (!file) {
+            std::cerr << "Ошибка создания файла индекса: " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool close() {
+        bool ok = fflush(file) == 0;
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+    
+    // NUM_TERMS и TOTAL_LENGTH могут быть ещё неизвестны - их дописывает finishIndex
+    void writeHeader(int termCount, int docCount) {
+        writeString("SIDX", 4);  
+        writeUInt32(INDEX_VERSION);
+        writeUInt32(termCount);  
+        writeUInt32(docCount);   
+        writeUInt64(INDEX_HEADER_SIZE);
+        writeUInt64(0);   
+        writeUInt64(0);   
+    }
+    
+    void writeTerm(const char* term, int termLen, const int* docIds, const int* termFreqs, int docCount) {
+        writeUInt16((unsigned short)termLen);
+        writeString(term, termLen);
+        writeUInt32(docCount);
+        
+        if (rawPostings) {
+            for (int j = 0; j < docCount; j++) {
+                writeUInt32(docIds[j]);
+            }
+            for (int j = 0; j < docCount; j++) {
+                writeUInt32(termFreqs[j]);
+            }
+            return;
+        }
+        
+        int codec;
+        int length = encodePostings(docIds, termFreqs, docCount, codec);
+        fputc(codec, file);
+        writeUInt32(length);
+        fwrite(encodeBuffer, 1, length, file);
+        
+        rawPostingBytes += docCount * 8LL;
+        encodedPostingBytes += length;
+        if (codec == CODEC_BP128) bp128Lists++;
+        else vbyteLists++;
+    }
+    
+    void printCompressionStats() const {
+        std::cout << "  Постинги: " << encodedPostingBytes / 1024 << " КБ вместо "
+                  << rawPostingBytes / 1024 << " КБ в uint32 DOC_ID + TF (VByte: " << vbyteLists
+                  << " листов, BP128: " << bp128Lists << ")" << std::endl;
+    }
+    
+    void beginForwardIndex() {
+        forwardIndexStart = ftell(file);
+    }
+    
+    void writeDocument(int docId, const char* url, int termCount) {
+        writeUInt32(docId);
+        
+        int urlLen = 0;
+        while (url[urlLen] != '\0' && urlLen < 511) urlLen++;
+        writeUInt16((unsigned short)urlLen);
+        writeString(url, urlLen);
+        
+        writeUInt32(termCount);
+        documentLengthSum += termCount;
+    }
+    
+    // Дописывает готовые байты (прямой индекс, накопленный отдельно)
+    bool appendFile(const char* filename) {
+        FILE* input = fopen(filename, "rb");
+        if (!input) return false;
+        
+        char buffer[1 << 16];
+        size_t bytes;
+        while ((bytes = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+            fwrite(buffer, 1, bytes, file);
+        }
+        fclose(input);
+        return true;
+    }
+    
+    void finishIndex(int termCount, unsigned long long totalLength) {
+        fseek(file, 8, SEEK_SET);
+        writeUInt32(termCount);
+        fseek(file, 24, SEEK_SET);
+        writeUInt64(forwardIndexStart);
+        writeUInt64(totalLength);
+    }
+    
+    long long getForwardIndexStart() const { return forwardIndexStart; }
+    unsigned long long getDocumentLengthSum() const { return documentLengthSum; }
+    
+    void writeIndex(InvertedIndex& invIndex, ForwardIndex& fwdIndex) {
+        std::cout << "\nЗапись бинарного индекса..." << std::endl;
+        
+        
+        int termCount = invIndex.getUniqueTerms();
+        TermEntry** allTerms = new TermEntry*[termCount];
+        int count = 0;
+        invIndex.getAllTerms(allTerms, count);
+        
+        std::cout << "Сортировка " << count << " термов..." << std::endl;
+        quickSortTerms(allTerms, 0, count - 1);
+        
+        writeSortedIndex(allTerms, count, fwdIndex);
+        delete[] allTerms;
+    }
+    
+    // Термы уже отсортированы (например, слиянием частичных индексов)
+    void writeSortedIndex(TermEntry** allTerms, int count, ForwardIndex& fwdIndex) {
+        writeHeader(count, fwdIndex.getSize());
+        
+        std::cout << "Запись инвертированного индекса..." << std::endl;
+        for (int i = 0; i < count; i++) {
+            TermEntry* entry = allTerms[i];
+            writeTerm(entry->term, entry->length, entry->postings.docIds.getData(),
+                      entry->postings.termFreqs.getData(), entry->postings.docIds.getSize());
+            
+            if ((i + 1) % 5000 == 0) {
+                std::cout << "  Записано термов: " << (i + 1) << std::endl;
+            }
+        }
+        
+        
+        beginForwardIndex();
+        
+        
+        std::cout << "Запись прямого индекса..." << std::endl;
+        DocumentMetadata* docs = fwdIndex.getAllDocuments();
+        for (int i = 0; i < fwdIndex.getSize(); i++) {
+            writeDocument(docs[i].docId, docs[i].url, docs[i].termCount);
+        }
+        
+        
+        finishIndex(count, documentLengthSum);
+        
+        std::cout << "Индекс успешно записан!" << std::endl;
+        printCompressionStats();
+        std::cout << "  Размер файла: " << (forwardIndexStart + fwdIndex.getSize() * 520) / 1024 << " КБ" << std::endl;
+    }
+};
+
+/*
+ПРОГОН SPIMI (RUN): файл index.bin.runN - последовательность термов без
+сжатия и без заголовка: TERM_LENGTH, TERM, DOC_COUNT, затем DOC_COUNT
+DOC_ID и DOC_COUNT TF, все uint32. Термы прогона отсортированы, постинг-листы отсортированы и
+без повторов.
+*/
+
+class RunReader {
+private:
+    MappedFile mapped;
+    const unsigned char* ptr;
+    const unsigned char* end;
+    
+public:
+    const char* term;
+    int termLen;
+    const unsigned char* docIds;
+    const unsigned char* termFreqs;
+    int docCount;
+    
+    RunReader() : ptr(nullptr), end(nullptr), term(nullptr), termLen(0), docIds(nullptr),
+                  termFreqs(nullptr), docCount(0) {}
+    
+    bool open(const char* filename) {
+        if (!mapped.open(filename)) return false;
+        ptr = (const unsigned char*)mapped.getData();
+        end = ptr + mapped.getSize();
+        return true;
+    }
+    
+    bool next() {
+        if (end - ptr < 6) return false;
+        termLen = ptr[0] | (ptr[1] << 8);
+        term = (const char*)ptr + 2;
+        ptr += 2 + termLen;
+        docCount = (int)(ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((unsigned int)ptr[3] << 24));
+        docIds = ptr + 4;
+        termFreqs = docIds + (long long)docCount * 4;
+        ptr += 4 + (long long)docCount * 8;
+        return ptr <= end;
+    }
+    
+    static int readInt(const unsigned char* p) {
+        return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+    }
+    
+    int getDocId(int index) const { return readInt(docIds + (long long)index * 4); }
+    int getTermFreq(int index) const { return readInt(termFreqs + (long long)index * 4); }
+};
+
+/*
+SPIMI (single-pass in-memory indexing): токены копятся в обычном
+InvertedIndex, пока его память не превысит бюджет. Тогда блок сортируется
+и сбрасывается на диск прогоном, а память освобождается целиком. Бюджет
+считается сверх пустого блока: арена и хеш-таблица резервируют память
+заранее, и иначе малый бюджет давал бы прогон на каждый документ. Блок
+сбрасывается только на границе документа, поэтому документ попадает ровно
+в один прогон, и при возрастающих DOC_ID листы прогонов просто сцепляются.
+Прямой индекс сразу пишется во временный файл в формате index.bin.
+В конце прогоны сливаются k-way слиянием через кучу; если прогонов больше
+SPIMI_MERGE_FAN_IN, сначала сливаются группами в промежуточные прогоны,
+чтобы не упереться в лимит открытых файлов.
+*/
+
+const long long DEFAULT_SPIMI_BUDGET_MB = 256;
+const int SPIMI_MERGE_FAN_IN = 64;
+
+class SpimiIndexer {
+private:
+    const char* outputName;
+    long long memoryBudget;
+    int termIdCount;
+    InvertedIndex* block;
+    long long blockBaseline;
+    bool blockEmpty;
+    BinaryIndexWriter forwardSpool;
+    char spoolName[512];
+    int runCount;
+    int documentCount;
+    int uniqueTerms;
+    long long totalOccurrences;
+    long long peakMemory;
+    int unsortedMerges;
+    
+    void runName(char* buffer, int number) const {
         int len = 0;
-        while (str[len] != '\0' && (maxLen == -1 || len < maxLen)) len++;
-        fwrite(str, 1, len, file);
+        while (outputName[len] != '\0' && len < 480) {
+            buffer[len] = outputName[len];
+            len++;
+        }
+        const char* suffix = ".run";
+        for (int i = 0; suffix[i] != '\0'; i++) {
+            buffer[len++] = suffix[i];
+        }
+        char digits[12];
+        int digitCount = 0;
+        do {
+            digits[digitCount++] = '0' + number % 10;
+            number /= 10;
+        } while (number > 0);
+        while (digitCount > 0) {
+            buffer[len++] = digits[--digitCount];
+        }
+        buffer[len] = '\0';
     }
     
-public:
-    BinaryIndexWriter() : file(nullptr) {}
+    void newBlock() {
+        block = new InvertedIndex();
+        block->reserveTermIds(termIdCount);
+        blockBaseline = block->getMemoryUsage();
+        blockEmpty = true;
+    }
     
-    ~BinaryIndexWriter() {
-        if (file) fclose(file);
+    int writeBlock(BinaryIndexWriter& out) {
+        block->finalizeAllPostings();
+        
+        int count = 0;
+        TermEntry** allTerms = new TermEntry*[block->getUniqueTerms()];
+        block->getAllTerms(allTerms, count);
+        quickSortTerms(allTerms, 0, count - 1);
+        
+        for (int i = 0; i < count; i++) {
+            out.writeTerm(allTerms[i]->term, allTerms[i]->length,
+                          allTerms[i]->postings.docIds.getData(),
+                          allTerms[i]->postings.termFreqs.getData(),
+                          allTerms[i]->postings.docIds.getSize());
+        }
+        delete[] allTerms;
+        return count;
     }
     
-    bool open(const char* filename) {
-        file = fopen(filename, "wb");
-        if (!file) {
-            std::cerr << "Ошибка создания файла индекса: " << filename << std::endl;
+    bool flushBlock() {
+        char name[512];
+        runName(name, runCount);
+        
+        BinaryIndexWriter run;
+        if (!run.open(name)) return false;
+        run.setRawPostings(true);
+        int terms = writeBlock(run);
+        if (!run.close()) {
+            std::cerr << "Ошибка записи прогона " << name << std::endl;
             return false;
         }
+        
+        std::cout << "  Прогон " << runCount << ": " << terms << " термов, память блока "
+                  << block->getMemoryUsage() / (1024 * 1024) << " МБ" << std::endl;
+        
+        totalOccurrences += block->getTotalOccurrences();
+        runCount++;
+        delete block;
+        newBlock();
         return true;
     }
     
-    void writeIndex(InvertedIndex& invIndex, ForwardIndex& fwdIndex) {
-        std::cout << "\nЗапись бинарного индекса..." << std::endl;
+    bool runLess(RunReader* readers, int a, int b) const {
+        int cmp = compareTerms(readers[a].term, readers[a].termLen, readers[b].term, readers[b].termLen);
+        return cmp < 0 || (cmp == 0 && a < b);
+    }
+    
+    void siftDown(int* heap, int heapSize, RunReader* readers) const {
+        int i = 0;
+        while (true) {
+            int smallest = i;
+            int left = 2 * i + 1;
+            int right = left + 1;
+            if (left < heapSize && runLess(readers, heap[left], heap[smallest])) smallest = left;
+            if (right < heapSize && runLess(readers, heap[right], heap[smallest])) smallest = right;
+            if (smallest == i) return;
+            int temp = heap[i];
+            heap[i] = heap[smallest];
+            heap[smallest] = temp;
+            i = smallest;
+        }
+    }
+    
+    void siftUp(int* heap, int i, RunReader* readers) const {
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!runLess(readers, heap[i], heap[parent])) return;
+            int temp = heap[i];
+            heap[i] = heap[parent];
+            heap[parent] = temp;
+            i = parent;
+        }
+    }
+    
+    // Сливает прогоны [first, first + count) в out; возвращает число термов или -1
+    int mergeRuns(int first, int count, BinaryIndexWriter& out) {
+        RunReader* readers = new RunReader[count];
+        int* heap = new int[count];
+        int* group = new int[count];
+        int heapSize = 0;
+        bool ok = true;
+        
+        for (int i = 0; i < count; i++) {
+            char name[512];
+            runName(name, first + i);
+            if (!readers[i].open(name)) {
+                std::cerr << "Не удалось открыть прогон " << name << std::endl;
+                ok = false;
+                break;
+            }
+            if (readers[i].next()) {
+                heap[heapSize] = i;
+                siftUp(heap, heapSize++, readers);
+            }
+        }
         
+        PostingList merged;
+        int terms = 0;
         
-        writeString("SIDX", 4);  
-        writeUInt32(1);          
-        writeUInt32(invIndex.getUniqueTerms());  
-        writeUInt32(fwdIndex.getSize());         
-        writeUInt64(32);  
-        writeUInt64(0);   
+        while (ok && heapSize > 0) {
+            // Все прогоны с минимальным термом; их порядок - порядок прогонов
+            int top = heap[0];
+            int groupSize = 0;
+            while (heapSize > 0 && compareTerms(readers[heap[0]].term, readers[heap[0]].termLen,
+                                                readers[top].term, readers[top].termLen) == 0) {
+                group[groupSize++] = heap[0];
+                heap[0] = heap[--heapSize];
+                siftDown(heap, heapSize, readers);
+            }
+            for (int i = 1; i < groupSize; i++) {
+                int run = group[i];
+                int j = i - 1;
+                while (j >= 0 && group[j] > run) {
+                    group[j + 1] = group[j];
+                    j--;
+                }
+                group[j + 1] = run;
+            }
+            
+            merged.clear();
+            for (int g = 0; g < groupSize; g++) {
+                RunReader& reader = readers[group[g]];
+                for (int j = 0; j < reader.docCount; j++) {
+                    merged.addPosting(reader.getDocId(j), reader.getTermFreq(j));
+                }
+            }
+            
+            // Запасной путь: DOC_ID шли не по возрастанию, листы прогонов пересекаются
+            if (merged.finalize()) {
+                unsortedMerges++;
+            }
+            
+            out.writeTerm(readers[top].term, readers[top].termLen, merged.docIds.getData(),
+                          merged.termFreqs.getData(), merged.docIds.getSize());
+            terms++;
+            
+            for (int g = 0; g < groupSize; g++) {
+                if (readers[group[g]].next()) {
+                    heap[heapSize] = group[g];
+                    siftUp(heap, heapSize++, readers);
+                }
+            }
+        }
         
-        long long invertedIndexStart = 32;
+        delete[] group;
+        delete[] heap;
+        delete[] readers;
+        return ok ? terms : -1;
+    }
+    
+    void removeRuns(int first, int count) const {
+        for (int i = 0; i < count; i++) {
+            char name[512];
+            runName(name, first + i);
+            unlink(name);
+        }
+    }
+    
+public:
+    SpimiIndexer() : outputName(nullptr), memoryBudget(0), termIdCount(0), block(nullptr),
+                     blockBaseline(0), blockEmpty(true), runCount(0), documentCount(0), uniqueTerms(0),
+                     totalOccurrences(0), peakMemory(0), unsortedMerges(0) {}
+    
+    ~SpimiIndexer() {
+        delete block;
+    }
+    
+    bool open(const char* output, long long budget, int termIds) {
+        outputName = output;
+        memoryBudget = budget;
+        termIdCount = termIds;
         
+        int len = 0;
+        while (output[len] != '\0' && len < 500) {
+            spoolName[len] = output[len];
+            len++;
+        }
+        spoolName[len++] = '.';
+        spoolName[len++] = 'f';
+        spoolName[len++] = 'w';
+        spoolName[len++] = 'd';
+        spoolName[len] = '\0';
         
-        int termCount = invIndex.getUniqueTerms();
-        TermEntry** allTerms = new TermEntry*[termCount];
-        int count = 0;
-        invIndex.getAllTerms(allTerms, count);
+        if (!forwardSpool.open(spoolName)) return false;
+        newBlock();
+        return true;
+    }
+    
+    void addTerm(int termId, const char* term, int len, int docId) {
+        if (termId >= 0) {
+            block->addTermById(termId, term, len, docId);
+        } else {
+            block->addTerm(term, len, docId);
+        }
+        blockEmpty = false;
+    }
+    
+    bool endDocument(int docId, const char* url, int termCount) {
+        if (url) {
+            forwardSpool.writeDocument(docId, url, termCount);
+            documentCount++;
+        }
         
-        std::cout << "Сортировка " << count << " термов..." << std::endl;
-        quickSortTerms(allTerms, 0, count - 1);
+        long long memory = block->getMemoryUsage();
+        if (memory > peakMemory) peakMemory = memory;
+        if (memory - blockBaseline >= memoryBudget && !blockEmpty) {
+            return flushBlock();
+        }
+        return true;
+    }
+    
+    bool finish() {
+        if (!forwardSpool.close()) {
+            std::cerr << "Ошибка записи прямого индекса " << spoolName << std::endl;
+            return false;
+        }
         
+        BinaryIndexWriter writer;
+        if (!writer.open(outputName)) return false;
+        writer.writeHeader(0, documentCount);
         
-        std::cout << "Запись инвертированного индекса..." << std::endl;
-        for (int i = 0; i < count; i++) {
-            TermEntry* entry = allTerms[i];
+        if (runCount == 0) {
+            // Весь корпус уместился в один блок - пишем его сразу в index.bin
+            std::cout << "  Корпус уместился в бюджет, прогоны не понадобились" << std::endl;
+            uniqueTerms = writeBlock(writer);
+            totalOccurrences += block->getTotalOccurrences();
+        } else {
+            if (!blockEmpty && !flushBlock()) return false;
             
+            int first = 0;
+            int end = runCount;
+            while (end - first > SPIMI_MERGE_FAN_IN) {
+                std::cout << "  Промежуточное слияние " << (end - first) << " прогонов..." << std::endl;
+                for (int group = first; group < end; group += SPIMI_MERGE_FAN_IN) {
+                    int count = end - group < SPIMI_MERGE_FAN_IN ? end - group : SPIMI_MERGE_FAN_IN;
+                    char name[512];
+                    runName(name, runCount);
+                    
+                    BinaryIndexWriter run;
+                    if (!run.open(name)) return false;
+                    run.setRawPostings(true);
+                    if (mergeRuns(group, count, run) < 0 || !run.close()) return false;
+                    runCount++;
+                    removeRuns(group, count);
+                }
+                first = end;
+                end = runCount;
+            }
             
-            int termLen = 0;
-            while (entry->term[termLen] != '\0') termLen++;
-            writeUInt16((unsigned short)termLen);
-            
-            
-            writeString(entry->term, termLen);
-            
+            std::cout << "  Слияние " << (end - first) << " прогонов в " << outputName << "..." << std::endl;
+            uniqueTerms = mergeRuns(first, end - first, writer);
+            removeRuns(first, end - first);
+            if (uniqueTerms < 0) return false;
+        }
+        
+        writer.beginForwardIndex();
+        if (!writer.appendFile(spoolName)) {
+            std::cerr << "Не удалось прочитать " << spoolName << std::endl;
+            return false;
+        }
+        unlink(spoolName);
+        writer.finishIndex(uniqueTerms, forwardSpool.getDocumentLengthSum());
+        
+        if (!writer.close()) {
+            std::cerr << "Ошибка записи " << outputName << std::endl;
+            return false;
+        }
+        
+        std::cout << "Индекс успешно записан!" << std::endl;
+        writer.printCompressionStats();
+        std::cout << "  Размер файла: " << (writer.getForwardIndexStart() + (long long)documentCount * 520) / 1024 << " КБ" << std::endl;
+        return true;
+    }
+    
+    int getRunCount() const { return runCount; }
+    int getDocumentCount() const { return documentCount; }
+    int getUniqueTerms() const { return uniqueTerms; }
+    long long getTotalOccurrences() const { return totalOccurrences; }
+    long long getPeakMemory() const { return peakMemory; }
+    int getUnsortedMerges() const { return unsortedMerges; }
+};
+
+template <typename Task>
+void runParallel(int num_threads, Task task) {
+    std::thread* workers = new std::thread[num_threads];
+    for (int t = 1; t < num_threads; t++) {
+        workers[t] = std::thread(task, t);
+    }
+    task(0);
+    for (int t = 1; t < num_threads; t++) {
+        workers[t].join();
+    }
+    delete[] workers;
+}
+
+/*
+МНОГОПОТОЧНОЕ ПОСТРОЕНИЕ: tokens.bin делится на диапазоны блоков документов
+(DOC_ID идут по возрастанию), каждый поток строит свой частичный
+InvertedIndex и ForwardIndex. Слияние идёт по TERM_ID словаря с чередованием
+(поток t берёт t, t + T, ...), чтобы частые термы с малыми id не достались
+одному потоку. Листы частей сцепляются в порядке диапазонов, поэтому
+остаются отсортированными; если части всё же пересеклись, лист
+досортировывается. Каждый поток сортирует свои термы, затем отсортированные
+части сливаются попарно. Прямые индексы частей просто склеиваются.
+*/
+
+class ParallelIndexBuilder {
+private:
+    struct Worker {
+        TokenCursor cursor;
+        InvertedIndex index;
+        ForwardIndex forward;
+        int processedTokens;
+        long long totalTermLength;
+        int skippedDuplicateTokens;
+        TermEntry** terms;
+        int termCount;
+        int unsortedMerges;
+    };
+    
+    int threadCount;
+    int partCount;
+    Worker* workers;
+    TermEntry** sorted;
+    int sortedCount;
+    
+    void buildPart(const TokenStreamReader& reader, const StringArray& urls, Worker& w) {
+        w.index.reserveTermIds(reader.getTermCount());
+        
+        int currentDocId = -1;
+        int termCountInDoc = 0;
+        int docId;
+        int termId;
+        const char* token;
+        int tokenLen;
+        int position;
+        int offset;
+        
+        while (reader.readFrom(w.cursor, docId, termId, token, tokenLen, position, offset)) {
+            if (reader.isDuplicate(docId)) {
+                w.skippedDuplicateTokens++;
+                continue;
+            }
             
-            int docCount = entry->postings.docIds.getSize();
-            writeUInt32(docCount);
+            if (docId != currentDocId) {
+                if (currentDocId != -1) {
+                    const char* url = urls.get(currentDocId - 1);
+                    if (url) {
+                        w.forward.addDocument(currentDocId, url, termCountInDoc);
+                    }
+                }
+                currentDocId = docId;
+                termCountInDoc = 0;
+            }
             
+            w.index.addTermById(termId, token, tokenLen, docId);
+            termCountInDoc++;
+            w.processedTokens++;
+            w.totalTermLength += tokenLen;
+        }
+        
+        if (currentDocId != -1) {
+            const char* url = urls.get(currentDocId - 1);
+            if (url) {
+                w.forward.addDocument(currentDocId, url, termCountInDoc);
+            }
+        }
+        
+        w.index.finalizeAllPostings();
+    }
+    
+    void mergeTerms(int thread, int termIdCount) {
+        Worker& self = workers[thread];
+        self.terms = new TermEntry*[termIdCount / threadCount + 1];
+        self.termCount = 0;
+        self.unsortedMerges = 0;
+        
+        for (int id = thread; id < termIdCount; id += threadCount) {
+            TermEntry* owner = nullptr;
             
-            for (int j = 0; j < docCount; j++) {
-                writeUInt32(entry->postings.docIds.get(j));
+            for (int part = 0; part < partCount; part++) {
+                TermEntry* entry = workers[part].index.getById(id);
+                if (!entry) continue;
+                if (!owner) {
+                    owner = entry;
+                } else {
+                    owner->postings.append(entry->postings);
+                }
             }
+            if (!owner) continue;
             
-            if ((i + 1) % 5000 == 0) {
-                std::cout << "  Записано термов: " << (i + 1) << std::endl;
+            if (owner->postings.finalize()) {
+                self.unsortedMerges++;
             }
+            self.terms[self.termCount++] = owner;
         }
         
-        delete[] allTerms;
+        quickSortTerms(self.terms, 0, self.termCount - 1);
+    }
+    
+    static void mergeSorted(TermEntry** a, int aCount, TermEntry** b, int bCount, TermEntry** out) {
+        int i = 0, j = 0, k = 0;
+        while (i < aCount && j < bCount) {
+            if (compareTerms(b[j]->term, b[j]->length, a[i]->term, a[i]->length) < 0) {
+                out[k++] = b[j++];
+            } else {
+                out[k++] = a[i++];
+            }
+        }
+        while (i < aCount) out[k++] = a[i++];
+        while (j < bCount) out[k++] = b[j++];
+    }
+    
+public:
+    ParallelIndexBuilder(int threads) : threadCount(threads), partCount(0), sorted(nullptr), sortedCount(0) {
+        workers = new Worker[threadCount];
+        for (int t = 0; t < threadCount; t++) {
+            workers[t].processedTokens = 0;
+            workers[t].totalTermLength = 0;
+            workers[t].skippedDuplicateTokens = 0;
+            workers[t].terms = nullptr;
+            workers[t].termCount = 0;
+            workers[t].unsortedMerges = 0;
+        }
+    }
+    
+    ~ParallelIndexBuilder() {
+        for (int t = 0; t < threadCount; t++) {
+            delete[] workers[t].terms;
+        }
+        delete[] workers;
+        delete[] sorted;
+    }
+    
+    void build(const TokenStreamReader& reader, const StringArray& urls) {
+        TokenCursor* cursors = new TokenCursor[threadCount];
+        partCount = reader.partition(cursors, threadCount);
+        for (int t = 0; t < partCount; t++) {
+            workers[t].cursor = cursors[t];
+        }
+        delete[] cursors;
         
+        runParallel(partCount, [&](int t) { buildPart(reader, urls, workers[t]); });
+    }
+    
+    void merge(int termIdCount) {
+        runParallel(threadCount, [&](int t) { mergeTerms(t, termIdCount); });
         
-        long long forwardIndexStart = ftell(file);
+        // Попарное слияние отсортированных частей; буфер и результат меняются местами
+        sortedCount = 0;
+        for (int t = 0; t < threadCount; t++) sortedCount += workers[t].termCount;
+        sorted = new TermEntry*[sortedCount > 0 ? sortedCount : 1];
+        TermEntry** buffer = new TermEntry*[sortedCount > 0 ? sortedCount : 1];
+        int* starts = new int[threadCount + 1];
         
+        starts[0] = 0;
+        for (int t = 0; t < threadCount; t++) {
+            for (int i = 0; i < workers[t].termCount; i++) {
+                sorted[starts[t] + i] = workers[t].terms[i];
+            }
+            starts[t + 1] = starts[t] + workers[t].termCount;
+        }
         
-        std::cout << "Запись прямого индекса..." << std::endl;
-        DocumentMetadata* docs = fwdIndex.getAllDocuments();
-        for (int i = 0; i < fwdIndex.getSize(); i++) {
-            writeUInt32(docs[i].docId);
-            
-            int urlLen = 0;
-            while (docs[i].url[urlLen] != '\0') urlLen++;
-            writeUInt16((unsigned short)urlLen);
-            writeString(docs[i].url, urlLen);
+        int runs = threadCount;
+        while (runs > 1) {
+            int merged = 0;
+            for (int r = 0; r < runs; r += 2) {
+                int from = starts[r];
+                int middle = starts[r + 1];
+                int to = r + 1 < runs ? starts[r + 2] : middle;
+                mergeSorted(sorted + from, middle - from, sorted + middle, to - middle, buffer + from);
+                starts[merged++] = from;
+            }
+            starts[merged] = sortedCount;
+            runs = merged;
             
-            writeUInt32(docs[i].termCount);
+            TermEntry** temp = sorted;
+            sorted = buffer;
+            buffer = temp;
         }
         
-        
-        fseek(file, 24, SEEK_SET);
-        writeUInt64(forwardIndexStart);
-        
-        std::cout << "Индекс успешно записан!" << std::endl;
-        std::cout << "  Размер файла: " << (forwardIndexStart + fwdIndex.getSize() * 520) / 1024 << " КБ" << std::endl;
+        delete[] starts;
+        delete[] buffer;
+    }
+    
+    void collectForward(ForwardIndex& out) const {
+        for (int t = 0; t < partCount; t++) {
+            out.append(workers[t].forward);
+        }
+    }
+    
+    int getPartCount() const { return partCount; }
+    TermEntry** getSortedTerms() const { return sorted; }
+    int getSortedCount() const { return sortedCount; }
+    
+    int getProcessedTokens() const {
+        int total = 0;
+        for (int t = 0; t < partCount; t++) total += workers[t].processedTokens;
+        return total;
+    }
+    
+    long long getTotalTermLength() const {
+        long long total = 0;
+        for (int t = 0; t < partCount; t++) total += workers[t].totalTermLength;
+        return total;
+    }
+    
+    int getSkippedDuplicateTokens() const {
+        int total = 0;
+        for (int t = 0; t < partCount; t++) total += workers[t].skippedDuplicateTokens;
+        return total;
+    }
+    
+    long long getTotalOccurrences() const {
+        long long total = 0;
+        for (int t = 0; t < partCount; t++) total += workers[t].index.getTotalOccurrences();
+        return total;
+    }
+    
+    int getUnsortedMerges() const {
+        int total = 0;
+        for (int t = 0; t < threadCount; t++) total += workers[t].unsortedMerges;
+        return total;
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    long long spimiBudget = 0;
+    int numThreads = 1;
+    for (int i = 1; i < argc; i++) {
+        if (myStrcmp(argv[i], "--threads") && i + 1 < argc) {
+            numThreads = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                numThreads = numThreads * 10 + (*p - '0');
+            }
+            if (numThreads == 0) {
+                numThreads = std::thread::hardware_concurrency();
+            }
+        } else if (myStrcmp(argv[i], "--spimi") && i + 1 < argc) {
+            long long megabytes = 0;
+            for (const char* p = argv[++i]; *p >= '0' && *p <= '9'; p++) {
+                megabytes = megabytes * 10 + (*p - '0');
+            }
+            spimiBudget = (megabytes > 0 ? megabytes : DEFAULT_SPIMI_BUDGET_MB) * 1024 * 1024;
+        } else {
+            std::cout << "Использование: " << argv[0] << " [--threads N] [--spimi MB]" << std::endl;
+            std::cout << "  --threads N - параллельное построение по диапазонам документов (0 = по числу ядер)" << std::endl;
+            std::cout << "  --spimi MB  - SPIMI: блоки по MB мегабайт сбрасываются на диск и сливаются (0 = 256)" << std::endl;
+            return 1;
+        }
+    }
+    
     std::cout << "=== ПОСТРОЕНИЕ БУЛЕВА ИНДЕКСА ===" << std::endl;
     std::cout << std::endl;
     
-    clock_t startTime = clock();
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
     
     
     
@@ -681,102 +2275,235 @@ int main() {
     
     
     
-    std::cout << "\nШаг 2: Чтение токенов из tokens.csv..." << std::endl;
-    
+    TokenStreamReader streamReader;
     CSVParser csvParser;
-    if (!csvParser.open("../lab3-5/tokens.csv")) {
-        return 1;
+    TokenSource* tokens;
+    
+    if (streamReader.open("../lab3-5/tokens.bin")) {
+        std::cout << "\nШаг 2: Чтение токенов из tokens.bin..." << std::endl;
+        std::cout << "  В потоке: " << streamReader.getDocCount() << " документов, "
+                  << streamReader.getTokenCount() << " токенов, "
+                  << streamReader.getTermCount() << " термов в словаре" << std::endl;
+        std::cout << "  Позиции токенов: " << (streamReader.hasPositions() ? "есть" : "нет") << std::endl;
+        if (streamReader.isDelta()) {
+            std::cout << "  Внимание: tokens.bin - дельта (удалённых документов: "
+                      << streamReader.getDeletedCount() << "), индекс будет неполным" << std::endl;
+        }
+        if (streamReader.getDuplicateCount() > 0) {
+            std::cout << "  Почти-дубликатов: " << streamReader.getDuplicateCount()
+                      << (streamReader.duplicatesDropped() ? " (выброшены токенизатором)" : " (пропускаются)") << std::endl;
+        }
+        tokens = &streamReader;
+    } else {
+        std::cout << "\nШаг 2: Чтение токенов из tokens.csv..." << std::endl;
+        if (!csvParser.open("../lab3-5/tokens.csv")) {
+            return 1;
+        }
+        tokens = &csvParser;
     }
     
     InvertedIndex invIndex;
     ForwardIndex fwdIndex;
+    SpimiIndexer* spimi = nullptr;
+    ParallelIndexBuilder* parallel = nullptr;
+    if (numThreads > 1) {
+        if (spimiBudget > 0) {
+            std::cout << "  --threads не совмещается с --spimi, индекс строится в один поток" << std::endl;
+        } else if (tokens == &streamReader && streamReader.hasDictionary()) {
+            parallel = new ParallelIndexBuilder(numThreads);
+        } else {
+            std::cout << "  Многопоточная сборка требует tokens.bin со словарём, индекс строится в один поток" << std::endl;
+        }
+    }
+    
+    if (spimiBudget > 0) {
+        spimi = new SpimiIndexer();
+        if (!spimi->open("index.bin", spimiBudget, tokens->getTermCount())) {
+            delete spimi;
+            return 1;
+        }
+        std::cout << "  Режим SPIMI: бюджет памяти блока " << spimiBudget / (1024 * 1024)
+                  << " МБ сверх пустого блока" << std::endl;
+    } else if (!parallel) {
+        invIndex.reserveTermIds(tokens->getTermCount());
+    }
     
-    int currentDocId = -1;
-    int termCountInDoc = 0;
-    int docId;
-    char token[256];
     int processedTokens = 0;
     long long totalTermLength = 0;
+    int skippedDuplicateTokens = 0;
     
-    while (csvParser.readNext(docId, token)) {
+    if (parallel) {
+        parallel->build(streamReader, urls);
+        std::cout << "  Потоков: " << numThreads << ", частей корпуса: " << parallel->getPartCount() << std::endl;
+        
+        processedTokens = parallel->getProcessedTokens();
+        totalTermLength = parallel->getTotalTermLength();
+        skippedDuplicateTokens = parallel->getSkippedDuplicateTokens();
+        parallel->collectForward(fwdIndex);
+    } else {
+        int currentDocId = -1;
+        int termCountInDoc = 0;
+        int docId;
+        int termId;
+        const char* token;
+        int tokenLen;
+        int position;
+        int offset;
+        while (tokens->readNext(docId, termId, token, tokenLen, position, offset)) {
+            if (tokens->isDuplicate(docId)) {
+                skippedDuplicateTokens++;
+                continue;
+            }
         
-        if (docId != currentDocId) {
+            if (docId != currentDocId) {
             
-            if (currentDocId != -1) {
-                const char* url = urls.get(currentDocId - 1);
-                if (url) {
-                    fwdIndex.addDocument(currentDocId, url, termCountInDoc);
+                if (currentDocId != -1) {
+                    const char* url = urls.get(currentDocId - 1);
+                    if (spimi) {
+                        if (!spimi->endDocument(currentDocId, url, termCountInDoc)) {
+                            delete spimi;
+                            return 1;
+                        }
+                    } else if (url) {
+                        fwdIndex.addDocument(currentDocId, url, termCountInDoc);
+                    }
                 }
-            }
             
-            currentDocId = docId;
-            termCountInDoc = 0;
-        }
-        
+                currentDocId = docId;
+                termCountInDoc = 0;
+            }
         
-        invIndex.addTerm(token, docId);
-        termCountInDoc++;
-        processedTokens++;
         
+            if (spimi) {
+                spimi->addTerm(termId, token, tokenLen, docId);
+            } else if (termId >= 0) {
+                invIndex.addTermById(termId, token, tokenLen, docId);
+            } else {
+                invIndex.addTerm(token, tokenLen, docId);
+            }
+            termCountInDoc++;
+            processedTokens++;
         
-        int len = 0;
-        while (token[len] != '\0') len++;
-        totalTermLength += len;
+            totalTermLength += tokenLen;
         
-        if (processedTokens % 50000 == 0) {
-            std::cout << "  Обработано токенов: " << processedTokens << std::endl;
+            if (processedTokens % 50000 == 0) {
+                std::cout << "  Обработано токенов: " << processedTokens << std::endl;
+            }
         }
-    }
     
     
-    if (currentDocId != -1) {
-        const char* url = urls.get(currentDocId - 1);
-        if (url) {
-            fwdIndex.addDocument(currentDocId, url, termCountInDoc);
+        if (currentDocId != -1) {
+            const char* url = urls.get(currentDocId - 1);
+            if (spimi) {
+                if (!spimi->endDocument(currentDocId, url, termCountInDoc)) {
+                    delete spimi;
+                    return 1;
+                }
+            } else if (url) {
+                fwdIndex.addDocument(currentDocId, url, termCountInDoc);
+            }
         }
     }
     
     std::cout << "  Всего обработано токенов: " << processedTokens << std::endl;
+    if (skippedDuplicateTokens > 0) {
+        std::cout << "  Пропущено токенов почти-дубликатов: " << skippedDuplicateTokens << std::endl;
+    }
     
     
     
     
     
-    std::cout << "\nШаг 3: Финализация индекса (сортировка постинг-листов)..." << std::endl;
-    invIndex.finalizeAllPostings();
-    
-    
-    
-    
-    
-    std::cout << "\nШаг 4: Запись бинарного индекса..." << std::endl;
+    int documentCount;
+    int uniqueTerms;
+    long long totalOccurrences;
     
-    BinaryIndexWriter writer;
-    if (!writer.open("index.bin")) {
-        return 1;
+    if (spimi) {
+        std::cout << "\nШаг 3-4: Слияние прогонов SPIMI в index.bin..." << std::endl;
+        bool ok = spimi->finish();
+        
+        documentCount = spimi->getDocumentCount();
+        uniqueTerms = spimi->getUniqueTerms();
+        totalOccurrences = spimi->getTotalOccurrences();
+        std::cout << "  Прогонов на диске: " << spimi->getRunCount()
+                  << ", пик памяти блока: " << spimi->getPeakMemory() / 1024 << " КБ" << std::endl;
+        if (spimi->getUnsortedMerges() > 0) {
+            std::cout << "  Листов, досортированных при слиянии: " << spimi->getUnsortedMerges() << std::endl;
+        }
+        delete spimi;
+        if (!ok) {
+            return 1;
+        }
+    } else if (parallel) {
+        std::cout << "\nШаг 3: Слияние частичных индексов по термам..." << std::endl;
+        parallel->merge(tokens->getTermCount());
+        if (parallel->getUnsortedMerges() > 0) {
+            std::cout << "  Листов, досортированных при слиянии: " << parallel->getUnsortedMerges() << std::endl;
+        }
+        
+        
+        
+        
+        
+        std::cout << "\nШаг 4: Запись бинарного индекса..." << std::endl;
+        
+        BinaryIndexWriter writer;
+        if (!writer.open("index.bin")) {
+            delete parallel;
+            return 1;
+        }
+        
+        std::cout << "\nЗапись бинарного индекса..." << std::endl;
+        writer.writeSortedIndex(parallel->getSortedTerms(), parallel->getSortedCount(), fwdIndex);
+        
+        documentCount = fwdIndex.getSize();
+        uniqueTerms = parallel->getSortedCount();
+        totalOccurrences = parallel->getTotalOccurrences();
+        delete parallel;
+    } else {
+        std::cout << "\nШаг 3: Финализация индекса (постинг-листы уже упорядочены)..." << std::endl;
+        int mergedLists = invIndex.finalizeAllPostings();
+        if (mergedLists > 0) {
+            std::cout << "  Листов с DOC_ID не по порядку, слиты заново: " << mergedLists << std::endl;
+        }
+        
+        
+        
+        
+        
+        std::cout << "\nШаг 4: Запись бинарного индекса..." << std::endl;
+        
+        BinaryIndexWriter writer;
+        if (!writer.open("index.bin")) {
+            return 1;
+        }
+        
+        writer.writeIndex(invIndex, fwdIndex);
+        
+        documentCount = fwdIndex.getSize();
+        uniqueTerms = invIndex.getUniqueTerms();
+        totalOccurrences = invIndex.getTotalOccurrences();
     }
     
-    writer.writeIndex(invIndex, fwdIndex);
-    
     
-    clock_t endTime = clock();
-    double totalTime = (double)(endTime - startTime) / CLOCKS_PER_SEC;
+    double totalTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
     
     std::cout << "\n" << std::string(70, '=') << std::endl;
     std::cout << "=== СТАТИСТИКА ИНДЕКСАЦИИ ===" << std::endl;
     std::cout << std::string(70, '=') << std::endl;
     
     std::cout << "\nОСНОВНЫЕ ПОКАЗАТЕЛИ:" << std::endl;
-    std::cout << "  Количество документов: " << fwdIndex.getSize() << std::endl;
-    std::cout << "  Количество уникальных термов: " << invIndex.getUniqueTerms() << std::endl;
-    std::cout << "  Общее количество токенов: " << invIndex.getTotalOccurrences() << std::endl;
+    std::cout << "  Количество документов: " << documentCount << std::endl;
+    std::cout << "  Количество уникальных термов: " << uniqueTerms << std::endl;
+    std::cout << "  Общее количество токенов: " << totalOccurrences << std::endl;
     
     double avgTermLength = (double)totalTermLength / processedTokens;
     std::cout << "\n  Средняя длина терма: " << avgTermLength << " символов" << std::endl;
+    std::cout << "  Средняя длина документа (avgdl): " << (double)totalOccurrences / documentCount << " токенов" << std::endl;
     
     std::cout << "\nПРОИЗВОДИТЕЛЬНОСТЬ:" << std::endl;
     std::cout << "  Общее время индексации: " << totalTime << " сек" << std::endl;
-    std::cout << "  Время на 1 документ: " << (totalTime / fwdIndex.getSize() * 1000) << " мс" << std::endl;
+    std::cout << "  Время на 1 документ: " << (totalTime / documentCount * 1000) << " мс" << std::endl;
     
     
     long estimatedDataSize = processedTokens * 10; 
@@ -797,15 +2524,15 @@ int main() {
     std::cout << "\nМАСШТАБИРУЕМОСТЬ:" << std::endl;
     std::cout << "  При увеличении данных в 10 раз:" << std::endl;
     std::cout << "    - Время индексации: ~" << (totalTime * 10) << " сек" << std::endl;
-    std::cout << "    - Размер индекса: ~" << (invIndex.getUniqueTerms() * 5 / 1024) << " МБ" << std::endl;
+    std::cout << "    - Размер индекса: ~" << (uniqueTerms * 5 / 1024) << " МБ" << std::endl;
     
     std::cout << "  При увеличении в 100 раз:" << std::endl;
     std::cout << "    - Время: ~" << (totalTime * 100 / 60) << " мин" << std::endl;
-    std::cout << "    - Потребуется: внешняя сортировка, разбиение на части" << std::endl;
+    std::cout << "    - Потребуется: внешняя сортировка, разбиение на части (режим --spimi)" << std::endl;
     
     std::cout << "  При увеличении в 1000 раз:" << std::endl;
     std::cout << "    - Не поместится в оперативную память" << std::endl;
-    std::cout << "    - Решение: распределённая индексация (MapReduce)" << std::endl;
+    std::cout << "    - Решение: --spimi с ограниченным бюджетом памяти, далее распределённая индексация (MapReduce)" << std::endl;
     
     std::cout << "\nОПТИМИЗАЦИИ:" << std::endl;
     std::cout << "  Текущие узкие места:" << std::endl;
@@ -814,9 +2541,9 @@ int main() {
     std::cout << "    - Запись в файл (можно буферизировать)" << std::endl;
     
     std::cout << "  Возможные улучшения:" << std::endl;
-    std::cout << "    + Многопоточность при построении индекса" << std::endl;
+    std::cout << "    + Совместить --threads и --spimi (параллельные блоки)" << std::endl;
     std::cout << "    + Использование mmap для больших файлов" << std::endl;
-    std::cout << "    + Сжатие постинг-листов (Gap encoding, VByte)" << std::endl;
+    std::cout << "    + Сжатие словаря термов (front coding)" << std::endl;
     std::cout << "    + Инкрементальная индексация" << std::endl;
     
     std::cout << "\n" << std::string(70, '=') << std::endl;
@@ -1,6 +1,7 @@
 
 #include <iostream>
 #include <ctime>
+#include <immintrin.h>
 
 int my_strcmp(const char* s1, const char* s2) {
     int i = 0;
@@ -13,6 +14,33 @@ int my_strcmp(const char* s1, const char* s2) {
     return s1[i] - s2[i];
 }
 
+const double LN2 = 0.6931471805599453;
+const double SQRT2 = 1.4142135623730951;
+const int LOG_SERIES_TERMS = 12;
+
+double myLog(double x) {
+    if (x <= 0) return 0;
+    
+    union { double value; unsigned long long bits; } split;
+    split.value = x;
+    int exponent = (int)(split.bits >> 52) - 1023;
+    split.bits = (split.bits & 0xFFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+    double mantissa = split.value;
+    if (mantissa > SQRT2) {
+        mantissa *= 0.5;
+        exponent++;
+    }
+    
+    double term = (mantissa - 1) / (mantissa + 1);
+    double term_sq = term * term;
+    double series = 1.0 / (2 * LOG_SERIES_TERMS - 1);
+    for (int i = LOG_SERIES_TERMS - 2; i >= 0; i--) {
+        series = series * term_sq + 1.0 / (2 * i + 1);
+    }
+    
+    return exponent * LN2 + 2 * term * series;
+}
+
 class DynamicArray {
 private:
     int* data;
@@ -89,9 +117,169 @@ struct DocumentInfo {
     int termCount;
 };
 
+/*
+Декодер сжатых постинг-листов index.bin версий 2 и 3 (формат описан в
+lab6/boolian_index.cpp): разности DOC_ID в VByte или блоками BP128, в
+версии 3 за ними тем же кодеком идут TF - 1. Блок BP128 упакован
+вертикально по 4 дорожкам, поэтому SSE2 за одну загрузку достаёт четыре
+соседние разности и сразу складывает их в префиксную сумму (для TF -
+просто прибавляет единицу). Хвост и листы VByte декодируются скалярно.
+*/
+
+const int CODEC_VBYTE = 0;
+const int CODEC_BP128 = 1;
+const int BP128_BLOCK = 128;
+
+class PostingDecoder {
+private:
+    typedef void (*BlockUnpacker)(const unsigned char* in, int bits, int base, bool delta, int* out);
+    
+    BlockUnpacker unpack_block;
+    const char* backend;
+    
+    static void unpackBlockScalar(const unsigned char* in, int bits, int base, bool delta, int* out);
+    static void unpackBlockSSE2(const unsigned char* in, int bits, int base, bool delta, int* out);
+    
+public:
+    PostingDecoder() {
+        unpack_block = unpackBlockScalar;
+        backend = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            unpack_block = unpackBlockSSE2;
+            backend = "SSE2";
+        }
+#endif
+    }
+    
+    const char* getBackend() const { return backend; }
+    
+    // Декодирует count значений в out и возвращает конец потока; nullptr - лист
+    // повреждён. delta - префиксная сумма от base (DOC_ID), иначе base + значение (TF)
+    const unsigned char* decode(const unsigned char* in, const unsigned char* end, int codec,
+                                int count, int base, bool delta, int* out) const {
+        int previous = base;
+        int i = 0;
+        
+        if (codec == CODEC_BP128) {
+            for (; count - i >= BP128_BLOCK; i += BP128_BLOCK) {
+                if (in >= end || *in > 32 || end - in - 1 < 16 * *in) return nullptr;
+                int bits = *in++;
+                unpack_block(in, bits, previous, delta, out + i);
+                in += 16 * bits;
+                if (delta) previous = out[i + BP128_BLOCK - 1];
+            }
+        } else if (codec != CODEC_VBYTE) {
+            return nullptr;
+        }
+        
+        for (; i < count; i++) {
+            unsigned int gap = 0;
+            int shift = 0;
+            while (in < end && (*in & 0x80)) {
+                gap |= (unsigned int)(*in++ & 0x7F) << shift;
+                shift += 7;
+            }
+            if (in >= end) return nullptr;
+            gap |= (unsigned int)(*in++) << shift;
+            if (delta) {
+                previous += gap;
+                out[i] = previous;
+            } else {
+                out[i] = previous + (int)gap;
+            }
+        }
+        return in;
+    }
+};
+
+const PostingDecoder postingDecoder;
+
+void PostingDecoder::unpackBlockScalar(const unsigned char* in, int bits, int base, bool delta, int* out) {
+    unsigned int mask = bits == 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+    for (int i = 0; i < BP128_BLOCK; i++) {
+        int lane = i & 3;
+        int bitPos = (i >> 2) * bits;
+        int word = bitPos >> 5;
+        int shift = bitPos & 31;
+        
+        unsigned int value = 0;
+        if (bits > 0) {
+            const unsigned char* p = in + (word * 4 + lane) * 4;
+            value = (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24)) >> shift;
+            if (shift + bits > 32) {
+                p += 16;
+                value |= (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24)) << (32 - shift);
+            }
+        }
+        if (delta) {
+            base += value & mask;
+            out[i] = base;
+        } else {
+            out[i] = base + (int)(value & mask);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+void PostingDecoder::unpackBlockSSE2(const unsigned char* in, int bits, int base, bool delta, int* out) {
+    __m128i carry = _mm_set1_epi32(base);
+    if (bits == 0) {
+        for (int j = 0; j < BP128_BLOCK; j += 4) {
+            _mm_storeu_si128((__m128i*)(out + j), carry);
+        }
+        return;
+    }
+    
+    __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : (int)((1u << bits) - 1));
+    for (int j = 0; j < BP128_BLOCK / 4; j++) {
+        int bitPos = j * bits;
+        int word = bitPos >> 5;
+        int shift = bitPos & 31;
+        
+        __m128i value = _mm_srl_epi32(_mm_loadu_si128((const __m128i*)(in + word * 16)), _mm_cvtsi32_si128(shift));
+        if (shift + bits > 32) {
+            __m128i high = _mm_loadu_si128((const __m128i*)(in + (word + 1) * 16));
+            value = _mm_or_si128(value, _mm_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+        }
+        value = _mm_and_si128(value, mask);
+        
+        if (delta) {
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 4));
+            value = _mm_add_epi32(value, _mm_slli_si128(value, 8));
+            value = _mm_add_epi32(value, carry);
+            carry = _mm_shuffle_epi32(value, 0xFF);
+        } else {
+            value = _mm_add_epi32(value, carry);
+        }
+        _mm_storeu_si128((__m128i*)(out + j * 4), value);
+    }
+}
+#else
+void PostingDecoder::unpackBlockSSE2(const unsigned char* in, int bits, int base, bool delta, int* out) {
+    unpackBlockScalar(in, bits, base, delta, out);
+}
+#endif
+
 struct TermInfo {
     char term[256];
     DynamicArray docIds;
+    DynamicArray termFreqs;
+    const unsigned char* encoded;
+    unsigned int encodedLength;
+    int docCount;
+    int codec;
+    bool decoded;
+    
+    TermInfo() : encoded(nullptr), encodedLength(0), docCount(0), codec(0), decoded(true) {}
+    
+    // В индексах до версии 3 TF не хранится - считаем каждое вхождение единичным
+    int getTermFreq(int index) const {
+        int tf = termFreqs.get(index);
+        return tf > 0 ? tf : 1;
+    }
 };
 
 class IndexReader {
@@ -101,14 +289,22 @@ private:
     int numDocs;
     long long invertedIndexOffset;
     long long forwardIndexOffset;
+    unsigned long long totalLength;
+    double avgDocLength;
     
     
     TermInfo* termCache;
     int termCacheSize;
+    unsigned int version;
+    unsigned char* postingsData;
+    int* decodeBuffer;
+    int decodeCapacity;
     
     
     DocumentInfo* docCache;
     int docCacheSize;
+    int* docIndex;
+    int docIndexSize;
     
     unsigned int readUInt32() {
         unsigned char bytes[4];
@@ -161,6 +357,79 @@ private:
         std::cout << "Термы загружены в память." << std::endl;
     }
     
+    // Версия 2: инвертированный индекс читается одним блоком и остаётся
+    // сжатым; лист терма декодируется при первом обращении к нему
+    bool loadCompressedTerms() {
+        long long size = forwardIndexOffset - invertedIndexOffset;
+        if (size < 0) return false;
+        
+        fseek(file, invertedIndexOffset, SEEK_SET);
+        postingsData = new unsigned char[size > 0 ? size : 1];
+        if ((long long)fread(postingsData, 1, size, file) != size) return false;
+        
+        termCache = new TermInfo[numTerms];
+        termCacheSize = 0;
+        
+        std::cout << "Загрузка " << numTerms << " термов (сжатые постинги, "
+                  << size / 1024 << " КБ)..." << std::endl;
+        
+        const unsigned char* p = postingsData;
+        const unsigned char* end = postingsData + size;
+        for (int i = 0; i < numTerms; i++) {
+            if (end - p < 2) return false;
+            int termLen = p[0] | (p[1] << 8);
+            if (termLen > 255 || end - p < 2 + termLen + 9) return false;
+            p += 2;
+            for (int k = 0; k < termLen; k++) termCache[i].term[k] = (char)p[k];
+            termCache[i].term[termLen] = '\0';
+            p += termLen;
+            
+            termCache[i].docCount = (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+            termCache[i].codec = p[4];
+            termCache[i].encodedLength = p[5] | (p[6] << 8) | (p[7] << 16) | ((unsigned int)p[8] << 24);
+            p += 9;
+            if ((unsigned long long)(end - p) < termCache[i].encodedLength) return false;
+            termCache[i].encoded = p;
+            termCache[i].decoded = false;
+            p += termCache[i].encodedLength;
+            
+            termCacheSize++;
+        }
+        
+        std::cout << "Термы загружены в память." << std::endl;
+        return true;
+    }
+    
+    void decodeTerm(TermInfo& info) {
+        if (info.docCount * 2 > decodeCapacity) {
+            delete[] decodeBuffer;
+            decodeCapacity = info.docCount * 4;
+            decodeBuffer = new int[decodeCapacity];
+        }
+        
+        const unsigned char* end = info.encoded + info.encodedLength;
+        int* freqs = decodeBuffer + info.docCount;
+        const unsigned char* p = postingDecoder.decode(info.encoded, end, info.codec, info.docCount,
+                                                       0, true, decodeBuffer);
+        if (p && version >= 3) {
+            p = postingDecoder.decode(p, end, info.codec, info.docCount, 1, false, freqs);
+        }
+        
+        if (!p) {
+            std::cerr << "Повреждён постинг-лист терма " << info.term << std::endl;
+        } else {
+            for (int i = 0; i < info.docCount; i++) {
+                info.docIds.add(decodeBuffer[i]);
+            }
+            if (version >= 3) {
+                for (int i = 0; i < info.docCount; i++) {
+                    info.termFreqs.add(freqs[i]);
+                }
+            }
+        }
+        info.decoded = true;
+    }
+    
     void loadAllDocuments() {
         fseek(file, forwardIndexOffset, SEEK_SET);
         
@@ -181,9 +450,34 @@ private:
             docCacheSize++;
         }
         
+        buildDocIndex();
         std::cout << "Документы загружены в память." << std::endl;
     }
     
+    // DOC_ID плотные (1..NUM_DOCS), поэтому документ ищется по таблице, а не
+    // перебором: BM25 берёт длину документа для каждого кандидата
+    void buildDocIndex() {
+        int maxDocId = 0;
+        unsigned long long lengthSum = 0;
+        for (int i = 0; i < docCacheSize; i++) {
+            if (docCache[i].docId > maxDocId) maxDocId = docCache[i].docId;
+            lengthSum += docCache[i].termCount;
+        }
+        
+        if (maxDocId <= 4LL * docCacheSize + 1024) {
+            docIndexSize = maxDocId + 1;
+            docIndex = new int[docIndexSize];
+            for (int i = 0; i < docIndexSize; i++) docIndex[i] = -1;
+            for (int i = 0; i < docCacheSize; i++) {
+                if (docCache[i].docId >= 0) docIndex[docCache[i].docId] = i;
+            }
+        }
+        
+        // До версии 3 TOTAL_LENGTH в заголовке нет - считаем по прямому индексу
+        if (version < 3) totalLength = lengthSum;
+        avgDocLength = docCacheSize > 0 ? (double)totalLength / docCacheSize : 0;
+    }
+    
     bool streq(const char* s1, const char* s2) const {
         int i = 0;
         while (s1[i] != '\0' && s2[i] != '\0') {
@@ -231,13 +525,17 @@ private:
     }
     
 public:
-    IndexReader() : file(nullptr), termCache(nullptr), docCache(nullptr),
-                    termCacheSize(0), docCacheSize(0) {}
+    IndexReader() : file(nullptr), totalLength(0), avgDocLength(0), termCache(nullptr), termCacheSize(0),
+                    version(0), postingsData(nullptr), decodeBuffer(nullptr), decodeCapacity(0),
+                    docCache(nullptr), docCacheSize(0), docIndex(nullptr), docIndexSize(0) {}
     
     ~IndexReader() {
         if (file) fclose(file);
         if (termCache) delete[] termCache;
         if (docCache) delete[] docCache;
+        delete[] docIndex;
+        delete[] postingsData;
+        delete[] decodeBuffer;
     }
     
     bool loadIndex(const char* filename) {
@@ -258,32 +556,59 @@ public:
             return false;
         }
         
-        unsigned int version = readUInt32();
+        version = readUInt32();
         numTerms = readUInt32();
         numDocs = readUInt32();
         invertedIndexOffset = readUInt64();
         forwardIndexOffset = readUInt64();
+        if (version >= 3) {
+            totalLength = readUInt64();
+        }
         
         std::cout << "  Версия: " << version << std::endl;
         std::cout << "  Термов: " << numTerms << std::endl;
         std::cout << "  Документов: " << numDocs << std::endl;
         
         
-        loadAllTerms();
+        if (version == 1) {
+            loadAllTerms();
+        } else if (version == 2 || version == 3) {
+            std::cout << "  Декодер постингов: " << postingDecoder.getBackend() << std::endl;
+            if (!loadCompressedTerms()) {
+                std::cerr << "Повреждён инвертированный индекс!" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Неподдерживаемая версия индекса: " << version << std::endl;
+            return false;
+        }
         loadAllDocuments();
+        std::cout << "  Средняя длина документа: " << avgDocLength << " токенов" << std::endl;
         
         return true;
     }
     
-    const DynamicArray* searchTerm(const char* term) const {
+    const TermInfo* getTerm(const char* term) {
         int idx = binarySearchTerm(term);
         if (idx == -1) {
             return nullptr;
         }
-        return &termCache[idx].docIds;
+        if (!termCache[idx].decoded) {
+            decodeTerm(termCache[idx]);
+        }
+        return &termCache[idx];
+    }
+    
+    const DynamicArray* searchTerm(const char* term) {
+        const TermInfo* info = getTerm(term);
+        return info ? &info->docIds : nullptr;
     }
     
     const DocumentInfo* getDocument(int docId) const {
+        if (docIndex) {
+            if (docId < 0 || docId >= docIndexSize || docIndex[docId] < 0) return nullptr;
+            return &docCache[docIndex[docId]];
+        }
         
         for (int i = 0; i < docCacheSize; i++) {
             if (docCache[i].docId == docId) {
@@ -294,39 +619,316 @@ public:
     }
     
     int getNumDocs() const { return numDocs; }
+    double getAvgDocLength() const { return avgDocLength; }
+};
+
+/*
+Суффиксный автомат стеммера: суффиксы записываются в обратном порядке в
+префиксное дерево, которое строится на этапе компиляции (constexpr).
+Байты, не встречающиеся ни в одном суффиксе, отображаются в класс 0 и
+сразу обрывают проход. Проход идёт с конца слова назад и запоминает самый
+длинный суффикс, после отсечения которого остаётся не меньше 3 байт.
+*/
+
+const int SUFFIX_MAX_NODES = 160;
+const int SUFFIX_MAX_CLASSES = 32;
+
+struct SuffixAutomaton {
+    unsigned char byte_class[256];
+    unsigned char transitions[SUFFIX_MAX_NODES][SUFFIX_MAX_CLASSES];
+    bool accepting[SUFFIX_MAX_NODES];
+    int node_count;
+    int class_count;
+    
+    int longestSuffix(const char* word, int len, int min_stem) const {
+        int node = 1;
+        int best = 0;
+        for (int depth = 1; depth <= len - min_stem; depth++) {
+            node = transitions[node][byte_class[(unsigned char)word[len - depth]]];
+            if (node == 0) break;
+            if (accepting[node]) best = depth;
+        }
+        return best;
+    }
+};
+
+template <int N>
+constexpr SuffixAutomaton buildSuffixAutomaton(const char* const (&suffixes)[N]) {
+    SuffixAutomaton automaton = {};
+    automaton.node_count = 2;
+    automaton.class_count = 1;
+    
+    for (int s = 0; s < N; s++) {
+        int len = 0;
+        while (suffixes[s][len] != '\0') len++;
+        
+        int node = 1;
+        for (int i = len - 1; i >= 0; i--) {
+            unsigned char c = (unsigned char)suffixes[s][i];
+            if (automaton.byte_class[c] == 0) {
+                automaton.byte_class[c] = (unsigned char)automaton.class_count++;
+            }
+            unsigned char cls = automaton.byte_class[c];
+            if (automaton.transitions[node][cls] == 0) {
+                automaton.transitions[node][cls] = (unsigned char)automaton.node_count++;
+            }
+            node = automaton.transitions[node][cls];
+        }
+        automaton.accepting[node] = true;
+    }
+    
+    return automaton;
+}
+
+constexpr const char* QUERY_SUFFIXES[] = {
+    "\xD0\xB0\xD0\xBC\xD0\xB8", "\xD1\x8F\xD0\xBC\xD0\xB8",
+    "\xD0\xBE\xD0\xB2", "\xD0\xB5\xD0\xB2",
+    "\xD0\xB0\xD1\x85", "\xD1\x8F\xD1\x85",
+    "\xD0\xBE\xD0\xBC", "\xD0\xB5\xD0\xBC",
+    "\xD0\xBE\xD0\xB9", "\xD0\xB5\xD0\xB9", "\xD1\x8B\xD0\xB9", "\xD0\xB8\xD0\xB9",
+    "\xD0\xB0\xD1\x8F", "\xD0\xBE\xD0\xB5", "\xD0\xB5\xD0\xB5",
+    "\xD1\x8B\xD0\xB5", "\xD0\xB8\xD0\xB5",
+    "\xD1\x82\xD1\x8C", "\xD0\xB5\xD1\x82", "\xD0\xB8\xD1\x82",
+    "\xD1\x83", "\xD0\xB0", "\xD1\x8F", "\xD1\x8B",
+    "\xD0\xB8", "\xD0\xBE", "\xD0\xB5",
+    "ing", "ed", "s"
+};
+
+constexpr SuffixAutomaton QUERY_SUFFIX_AUTOMATON = buildSuffixAutomaton(QUERY_SUFFIXES);
+
+/*
+Приведение к нижнему регистру для латиницы, кириллицы и Ё. Каждый байт
+сворачивается независимо по тройке (предыдущий, текущий, следующий):
+заглавная кириллица D0 90..AF и D0 81 превращается в D0 B0..BF, D1 80..8F
+и D1 91, поэтому ведущий D0 меняется на D1 по следующему байту, а
+продолжение - по тому, что перед ним стоит D0. Продолжения никогда не
+равны D0 и не бывают ASCII, так что правило не зависит от разбора пар.
+Векторные ядра обрабатывают по 16/32 байт, хвост - две таблицы по 256;
+без SSE4.2 весь текст сворачивается по таблицам.
+*/
+
+class CaseFolder {
+private:
+    typedef int (*BlockFolder)(unsigned char* str, int len, unsigned char& prev);
+    
+    BlockFolder fold_blocks;
+    const char* backend;
+    
+    static int foldBlocksSSE(unsigned char* str, int len, unsigned char& prev);
+    static int foldBlocksAVX2(unsigned char* str, int len, unsigned char& prev);
+    
+    unsigned char fold_table[2][256];
+    unsigned char lead_flip[256];
+    
+public:
+    CaseFolder() {
+        for (int c = 0; c < 256; c++) {
+            unsigned char plain = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+            fold_table[0][c] = plain;
+            fold_table[1][c] = plain;
+            if (c >= 0x90 && c <= 0x9F) fold_table[1][c] = c + 0x20;
+            if (c >= 0xA0 && c <= 0xAF) fold_table[1][c] = c - 0x20;
+            if (c == 0x81) fold_table[1][c] = 0x91;
+            lead_flip[c] = ((c >= 0xA0 && c <= 0xAF) || c == 0x81) ? 0x01 : 0x00;
+        }
+        
+        fold_blocks = nullptr;
+        backend = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            fold_blocks = foldBlocksAVX2;
+            backend = "AVX2";
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            fold_blocks = foldBlocksSSE;
+            backend = "SSE4.2";
+        }
+#endif
+    }
+    
+    const char* getBackend() const { return backend; }
+    
+    void fold(char* text, int len) const {
+        unsigned char* str = (unsigned char*)text;
+        unsigned char prev = 0;
+        int i = fold_blocks ? fold_blocks(str, len, prev) : 0;
+        for (; i < len; i++) {
+            unsigned char c = str[i];
+            unsigned char next = (i + 1 < len) ? str[i + 1] : 0;
+            str[i] = fold_table[prev == 0xD0][c] ^ (lead_flip[next] & -(unsigned char)(c == 0xD0));
+            prev = c;
+        }
+    }
+};
+
+const CaseFolder caseFolder;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static inline __m128i inRange(__m128i bytes, unsigned char low, unsigned char width) {
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8((char)low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8((char)width)), shifted);
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i foldVector(__m128i cur, __m128i before, __m128i next) {
+    __m128i after_lead = _mm_cmpeq_epi8(before, _mm_set1_epi8((char)0xD0));
+    __m128i lead = _mm_and_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8((char)0xD0)),
+                                 _mm_or_si128(inRange(next, 0xA0, 15), _mm_cmpeq_epi8(next, _mm_set1_epi8((char)0x81))));
+    
+    __m128i delta = _mm_and_si128(inRange(cur, 'A', 25), _mm_set1_epi8(0x20));
+    __m128i continuation = _mm_and_si128(inRange(cur, 0x90, 15), _mm_set1_epi8(0x20));
+    continuation = _mm_or_si128(continuation, _mm_and_si128(inRange(cur, 0xA0, 15), _mm_set1_epi8((char)0xE0)));
+    continuation = _mm_or_si128(continuation, _mm_and_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8((char)0x81)), _mm_set1_epi8(0x10)));
+    delta = _mm_or_si128(delta, _mm_and_si128(after_lead, continuation));
+    delta = _mm_or_si128(delta, _mm_and_si128(lead, _mm_set1_epi8(0x01)));
+    return _mm_add_epi8(cur, delta);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRange(__m256i bytes, unsigned char low, unsigned char width) {
+    __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8((char)low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8((char)width)), shifted);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i foldVector(__m256i cur, __m256i before, __m256i next) {
+    __m256i after_lead = _mm256_cmpeq_epi8(before, _mm256_set1_epi8((char)0xD0));
+    __m256i lead = _mm256_and_si256(_mm256_cmpeq_epi8(cur, _mm256_set1_epi8((char)0xD0)),
+                                    _mm256_or_si256(inRange(next, 0xA0, 15), _mm256_cmpeq_epi8(next, _mm256_set1_epi8((char)0x81))));
+    
+    __m256i delta = _mm256_and_si256(inRange(cur, 'A', 25), _mm256_set1_epi8(0x20));
+    __m256i continuation = _mm256_and_si256(inRange(cur, 0x90, 15), _mm256_set1_epi8(0x20));
+    continuation = _mm256_or_si256(continuation, _mm256_and_si256(inRange(cur, 0xA0, 15), _mm256_set1_epi8((char)0xE0)));
+    continuation = _mm256_or_si256(continuation, _mm256_and_si256(_mm256_cmpeq_epi8(cur, _mm256_set1_epi8((char)0x81)), _mm256_set1_epi8(0x10)));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(after_lead, continuation));
+    delta = _mm256_or_si256(delta, _mm256_and_si256(lead, _mm256_set1_epi8(0x01)));
+    return _mm256_add_epi8(cur, delta);
+}
+
+__attribute__((target("sse4.2")))
+int CaseFolder::foldBlocksSSE(unsigned char* str, int len, unsigned char& prev) {
+    int i = 0;
+    __m128i previous = _mm_insert_epi8(_mm_setzero_si128(), prev, 15);
+    while (len - i > 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(str + i));
+        __m128i next = _mm_loadu_si128((const __m128i*)(str + i + 1));
+        __m128i before = _mm_alignr_epi8(cur, previous, 15);
+        _mm_storeu_si128((__m128i*)(str + i), foldVector(cur, before, next));
+        previous = cur;
+        i += 16;
+    }
+    prev = (unsigned char)_mm_extract_epi8(previous, 15);
+    return i;
+}
+
+__attribute__((target("avx2")))
+int CaseFolder::foldBlocksAVX2(unsigned char* str, int len, unsigned char& prev) {
+    int i = 0;
+    __m256i previous = _mm256_insert_epi8(_mm256_setzero_si256(), prev, 31);
+    while (len - i > 32) {
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(str + i + 1));
+        __m256i before = _mm256_alignr_epi8(cur, _mm256_permute2x128_si256(previous, cur, 0x21), 15);
+        
+        _mm256_storeu_si256((__m256i*)(str + i), foldVector(cur, before, next));
+        previous = cur;
+        i += 32;
+    }
+    prev = (unsigned char)_mm256_extract_epi8(previous, 31);
+    return i + foldBlocksSSE(str + i, len - i, prev);
+}
+#endif
+
+unsigned int hashBytes(const char* str, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+/*
+Кэш стемминга с прямым отображением: слот выбирается по хешу словоформы,
+при коллизии старая запись перезаписывается. Основа всегда является
+префиксом словоформы, поэтому хранится только её длина.
+*/
+
+class StemCache {
+private:
+    static const int SLOT_COUNT = 4096;
+    static const int MAX_KEY_LENGTH = 58;
+    
+    struct Slot {
+        unsigned int hash;
+        unsigned char length;
+        unsigned char stem_length;
+        char key[MAX_KEY_LENGTH];
+    };
+    
+    Slot* slots;
+    long long lookups;
+    long long hits;
+    
+    StemCache(const StemCache&) = delete;
+    StemCache& operator=(const StemCache&) = delete;
+    
+public:
+    StemCache() : lookups(0), hits(0) {
+        slots = new Slot[SLOT_COUNT];
+        for (int i = 0; i < SLOT_COUNT; i++) {
+            slots[i].length = 0;
+        }
+    }
+    
+    ~StemCache() {
+        delete[] slots;
+    }
+    
+    int find(const char* word, int len, unsigned int hash) {
+        lookups++;
+        const Slot& slot = slots[hash & (SLOT_COUNT - 1)];
+        if (slot.hash != hash || slot.length != len) return -1;
+        for (int i = 0; i < len; i++) {
+            if (slot.key[i] != word[i]) return -1;
+        }
+        hits++;
+        return slot.stem_length;
+    }
+    
+    void store(const char* word, int len, unsigned int hash, int stem_len) {
+        if (len > MAX_KEY_LENGTH) return;
+        Slot& slot = slots[hash & (SLOT_COUNT - 1)];
+        slot.hash = hash;
+        slot.length = (unsigned char)len;
+        slot.stem_length = (unsigned char)stem_len;
+        for (int i = 0; i < len; i++) {
+            slot.key[i] = word[i];
+        }
+    }
+    
+    long long getLookups() const { return lookups; }
+    long long getHits() const { return hits; }
 };
 
 class SimpleStemmer {
 private:
     char buffer[256];
     int len;
+    StemCache cache;
     
     void copy(const char* str) {
         len = 0;
         while (str[len] != '\0' && len < 255) {
-            char c = str[len];
-            if (c >= 'A' && c <= 'Z') c = c + 32;
-            buffer[len] = c;
+            buffer[len] = str[len];
             len++;
         }
         buffer[len] = '\0';
-    }
-    
-    bool removeIfEndsWith(const char* ending) {
-        int endLen = 0;
-        while (ending[endLen] != '\0') endLen++;
-        
-        if (len < endLen || len - endLen < 3) return false;
-        
-        for (int i = 0; i < endLen; i++) {
-            if (buffer[len - endLen + i] != ending[i]) {
-                return false;
-            }
-        }
-        
-        len -= endLen;
-        buffer[len] = '\0';
-        return true;
+        caseFolder.fold(buffer, len);
     }
     
 public:
@@ -334,40 +936,15 @@ public:
         copy(word);
         if (len < 4) return buffer;
         
+        unsigned int hash = hashBytes(buffer, len);
+        int stem_len = cache.find(buffer, len, hash);
+        if (stem_len < 0) {
+            stem_len = len - QUERY_SUFFIX_AUTOMATON.longestSuffix(buffer, len, 3);
+            cache.store(buffer, len, hash, stem_len);
+        }
         
-        if (removeIfEndsWith("\xD0\xB0\xD0\xBC\xD0\xB8")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD0\xBC\xD0\xB8")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB2")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB2")) return buffer;
-        if (removeIfEndsWith("\xD0\xB0\xD1\x85")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F\xD1\x85")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE\xD0\xBC")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xBC")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD1\x8B\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD0\xB9")) return buffer;
-        if (removeIfEndsWith("\xD0\xB0\xD1\x8F")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD1\x8B\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD0\xB5")) return buffer;
-        if (removeIfEndsWith("\xD1\x82\xD1\x8C")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5\xD1\x82")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8\xD1\x82")) return buffer;
-        if (removeIfEndsWith("\xD1\x83")) return buffer;
-        if (removeIfEndsWith("\xD0\xB0")) return buffer;
-        if (removeIfEndsWith("\xD1\x8F")) return buffer;
-        if (removeIfEndsWith("\xD1\x8B")) return buffer;
-        if (removeIfEndsWith("\xD0\xB8")) return buffer;
-        if (removeIfEndsWith("\xD0\xBE")) return buffer;
-        if (removeIfEndsWith("\xD0\xB5")) return buffer;
-        
-        
-        if (removeIfEndsWith("ing")) return buffer;
-        if (removeIfEndsWith("ed")) return buffer;
-        if (removeIfEndsWith("s")) return buffer;
-        
+        len = stem_len;
+        buffer[len] = '\0';
         return buffer;
     }
 };
@@ -462,6 +1039,8 @@ struct Token {
     char value[256];
 };
 
+const int MAX_QUERY_TERMS = 64;
+
 class QueryParser {
 private:
     const char* input;
@@ -472,6 +1051,22 @@ private:
     SimpleStemmer stemmer;
     int totalDocs;
     
+    // Основы слов вне отрицания - по ним ранжирует BM25
+    char queryTerms[MAX_QUERY_TERMS][256];
+    int queryTermCount;
+    int negationDepth;
+    
+    void addQueryTerm(const char* stem) {
+        if (negationDepth > 0 || queryTermCount >= MAX_QUERY_TERMS) return;
+        for (int i = 0; i < queryTermCount; i++) {
+            if (my_strcmp(queryTerms[i], stem) == 0) return;
+        }
+        int i = 0;
+        for (; stem[i] != '\0' && i < 255; i++) queryTerms[queryTermCount][i] = stem[i];
+        queryTerms[queryTermCount][i] = '\0';
+        queryTermCount++;
+    }
+    
     void skipWhitespace() {
         while (input[pos] == ' ' || input[pos] == '\t' || input[pos] == '\n') {
             pos++;
@@ -546,14 +1141,20 @@ private:
     DynamicArray parseFactor();
     
 public:
-    QueryParser(IndexReader* idx, int numDocs) : index(idx), totalDocs(numDocs), pos(0) {}
+    QueryParser(IndexReader* idx, int numDocs) : pos(0), index(idx), totalDocs(numDocs),
+                                                 queryTermCount(0), negationDepth(0) {}
     
     DynamicArray parse(const char* query) {
         input = query;
         pos = 0;
+        queryTermCount = 0;
+        negationDepth = 0;
         nextToken();
         return parseExpression();
     }
+    
+    int getQueryTermCount() const { return queryTermCount; }
+    const char* getQueryTerm(int i) const { return queryTerms[i]; }
 };
 
 
@@ -593,7 +1194,9 @@ DynamicArray QueryParser::parseTerm() {
 DynamicArray QueryParser::parseFactor() {
     if (currentToken.type == TOKEN_NOT) {
         nextToken();
+        negationDepth++;
         DynamicArray operand = parseFactor();
+        negationDepth--;
         return BooleanOperations::negate(operand, totalDocs);
     }
     
@@ -612,6 +1215,7 @@ DynamicArray QueryParser::parseFactor() {
         
         
         const DynamicArray* postings = index->searchTerm(stem);
+        addQueryTerm(stem);
         
         nextToken();
         
@@ -627,7 +1231,114 @@ DynamicArray QueryParser::parseFactor() {
     return DynamicArray();
 }
 
-void printResults(const DynamicArray& results, IndexReader& index, int maxResults = 50) {
+/*
+Ранжирование BM25 (k1 = 1.2, b = 0.75) поверх булевой выдачи. Всё нужное
+уже в памяти: df - длина листа, TF - поток TF листа (индекс версии 3),
+длина документа - TERM_COUNT прямого индекса, avgdl - из заголовка. Выдача
+и листы отсортированы по DOC_ID, поэтому TF находятся одним проходом
+слиянием. Сортировка по убыванию оценки устойчивая - при равенстве выше
+меньший DOC_ID.
+*/
+
+const double BM25_K1 = 1.2;
+const double BM25_B = 0.75;
+
+class BM25Ranker {
+private:
+    IndexReader* index;
+    double* scores;
+    int* order;
+    int* buffer;
+    int capacity;
+    
+    void reserve(int count) {
+        if (count <= capacity) return;
+        delete[] scores;
+        delete[] order;
+        delete[] buffer;
+        capacity = count * 2;
+        scores = new double[capacity];
+        order = new int[capacity];
+        buffer = new int[capacity];
+    }
+    
+    void mergeSort(int low, int high) {
+        if (high - low < 2) return;
+        int mid = (low + high) / 2;
+        mergeSort(low, mid);
+        mergeSort(mid, high);
+        
+        int i = low, j = mid, k = low;
+        while (i < mid && j < high) {
+            buffer[k++] = scores[order[j]] > scores[order[i]] ? order[j++] : order[i++];
+        }
+        while (i < mid) buffer[k++] = order[i++];
+        while (j < high) buffer[k++] = order[j++];
+        for (k = low; k < high; k++) order[k] = buffer[k];
+    }
+    
+    void addTerm(const DynamicArray& results, const TermInfo& info) {
+        int numDocs = index->getNumDocs();
+        double avgdl = index->getAvgDocLength();
+        int df = info.docIds.getSize();
+        double idf = myLog(1.0 + (numDocs - df + 0.5) / (df + 0.5));
+        
+        int i = 0, j = 0;
+        while (i < results.getSize() && j < df) {
+            int docId = results.get(i);
+            int posting = info.docIds.get(j);
+            if (docId < posting) {
+                i++;
+            } else if (docId > posting) {
+                j++;
+            } else {
+                const DocumentInfo* doc = index->getDocument(docId);
+                double dl = doc ? doc->termCount : avgdl;
+                double tf = info.getTermFreq(j);
+                double norm = avgdl > 0 ? 1 - BM25_B + BM25_B * dl / avgdl : 1;
+                scores[i] += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * norm);
+                i++;
+                j++;
+            }
+        }
+    }
+    
+public:
+    BM25Ranker(IndexReader* idx) : index(idx), scores(nullptr), order(nullptr), buffer(nullptr), capacity(0) {}
+    
+    ~BM25Ranker() {
+        delete[] scores;
+        delete[] order;
+        delete[] buffer;
+    }
+    
+    // Переставляет выдачу по убыванию BM25; getScore(i) - оценка i-го результата
+    DynamicArray rank(const DynamicArray& results, const QueryParser& parser) {
+        int count = results.getSize();
+        reserve(count);
+        for (int i = 0; i < count; i++) {
+            scores[i] = 0;
+            order[i] = i;
+        }
+        
+        for (int t = 0; t < parser.getQueryTermCount(); t++) {
+            const TermInfo* info = index->getTerm(parser.getQueryTerm(t));
+            if (info) addTerm(results, *info);
+        }
+        mergeSort(0, count);
+        
+        DynamicArray ranked;
+        for (int i = 0; i < count; i++) {
+            ranked.add(results.get(order[i]));
+        }
+        return ranked;
+    }
+    
+    double getScore(int rank) const { return scores[order[rank]]; }
+};
+
+void printResults(const DynamicArray& results, IndexReader& index, const BM25Ranker* ranker = nullptr,
+                  int maxResults = 50) {
     std::cout << "\nНайдено документов: " << results.getSize() << std::endl;
     
     if (results.getSize() == 0) {
@@ -642,7 +1353,10 @@ void printResults(const DynamicArray& results, IndexReader& index, int maxResult
         int docId = results.get(i);
         const DocumentInfo* doc = index.getDocument(docId);
         
-        if (doc) {
+        if (doc && ranker) {
+            std::cout << (i + 1) << ". [Doc " << docId << ", BM25 " << ranker->getScore(i) << "] "
+                      << doc->url << std::endl;
+        } else if (doc) {
             std::cout << (i + 1) << ". [Doc " << docId << "] " << doc->url << std::endl;
         }
     }
@@ -652,16 +1366,20 @@ void printResults(const DynamicArray& results, IndexReader& index, int maxResult
     }
 }
 
-void interactiveSearch(IndexReader& index) {
+void interactiveSearch(IndexReader& index, bool bm25) {
     std::cout << "\n=== ИНТЕРАКТИВНЫЙ ПОИСК ===" << std::endl;
     std::cout << "Синтаксис:" << std::endl;
     std::cout << "  пробел или && - AND" << std::endl;
     std::cout << "  || - OR" << std::endl;
     std::cout << "  ! - NOT" << std::endl;
     std::cout << "  () - группировка" << std::endl;
+    if (bm25) {
+        std::cout << "Выдача ранжируется по BM25" << std::endl;
+    }
     std::cout << "Введите 'exit' для выхода\n" << std::endl;
     
     QueryParser parser(&index, index.getNumDocs());
+    BM25Ranker ranker(&index);
     char query[1024];
     
     while (true) {
@@ -678,16 +1396,19 @@ void interactiveSearch(IndexReader& index) {
         
         clock_t start = clock();
         DynamicArray results = parser.parse(query);
+        if (bm25) {
+            results = ranker.rank(results, parser);
+        }
         clock_t end = clock();
         
         double time = (double)(end - start) / CLOCKS_PER_SEC * 1000;
         
-        printResults(results, index);
+        printResults(results, index, bm25 ? &ranker : nullptr);
         std::cout << "\nВремя поиска: " << time << " мс" << std::endl;
     }
 }
 
-void batchSearch(IndexReader& index, const char* inputFile, const char* outputFile) {
+void batchSearch(IndexReader& index, const char* inputFile, const char* outputFile, bool bm25) {
     FILE* fin = fopen(inputFile, "r");
     if (!fin) {
         std::cerr << "Ошибка открытия файла: " << inputFile << std::endl;
@@ -702,6 +1423,7 @@ void batchSearch(IndexReader& index, const char* inputFile, const char* outputFi
     }
     
     QueryParser parser(&index, index.getNumDocs());
+    BM25Ranker ranker(&index);
     char query[1024];
     int queryNum = 0;
     
@@ -720,6 +1442,9 @@ void batchSearch(IndexReader& index, const char* inputFile, const char* outputFi
         
         clock_t start = clock();
         DynamicArray results = parser.parse(query);
+        if (bm25) {
+            results = ranker.rank(results, parser);
+        }
         clock_t end = clock();
         
         double time = (double)(end - start) / CLOCKS_PER_SEC * 1000;
@@ -747,6 +1472,21 @@ int main(int argc, char* argv[]) {
     std::cout << "=== БУЛЕВ ПОИСК ===" << std::endl;
     std::cout << std::endl;
     
+    // --bm25 в любом месте командной строки: выдача по убыванию BM25
+    bool bm25 = false;
+    const char* files[2] = {nullptr, nullptr};
+    int fileCount = 0;
+    bool badArgs = false;
+    for (int i = 1; i < argc; i++) {
+        if (my_strcmp(argv[i], "--bm25") == 0) {
+            bm25 = true;
+        } else if (fileCount < 2) {
+            files[fileCount++] = argv[i];
+        } else {
+            badArgs = true;
+        }
+    }
+    
     
     IndexReader index;
     if (!index.loadIndex("../lab6/index.bin")) {
@@ -756,16 +1496,17 @@ int main(int argc, char* argv[]) {
     std::cout << "\nИндекс загружен!" << std::endl;
     
     
-    if (argc == 1) {
+    if (!badArgs && fileCount == 0) {
         
-        interactiveSearch(index);
-    } else if (argc == 3) {
+        interactiveSearch(index, bm25);
+    } else if (!badArgs && fileCount == 2) {
         
-        batchSearch(index, argv[1], argv[2]);
+        batchSearch(index, files[0], files[1], bm25);
     } else {
         std::cout << "Использование:" << std::endl;
-        std::cout << "  " << argv[0] << "                    - интерактивный режим" << std::endl;
-        std::cout << "  " << argv[0] << " <input> <output>  - пакетный режим" << std::endl;
+        std::cout << "  " << argv[0] << " [--bm25]                    - интерактивный режим" << std::endl;
+        std::cout << "  " << argv[0] << " [--bm25] <input> <output>  - пакетный режим" << std::endl;
+        std::cout << "  --bm25 - ранжировать найденные документы по BM25" << std::endl;
     }
     
     return 0;